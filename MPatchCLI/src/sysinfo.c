@@ -18,13 +18,34 @@
 /* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.        */
 /* ---------------------------------------------------------------------------------------------- */
 
+#if defined(__linux__) && (!defined(_GNU_SOURCE))
+#define _GNU_SOURCE /*for sched_getaffinity()*/
+#endif
+
 #include "sysinfo.h"
 
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN 1
 #include <Windows.h>
+#else
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#endif
+
+#ifdef __linux__
+#include <sched.h>
+#include <errno.h>
+#endif
+
+#include <stdlib.h>
 #include <malloc.h>
 
+#ifdef _WIN32
+
+
 typedef BOOL(WINAPI *GET_LOGICAL_PROCINFO)(PSYSTEM_LOGICAL_PROCESSOR_INFORMATION, PDWORD);
+typedef DWORD(WINAPI *GET_ACTIVE_PROCCOUNT)(WORD);
 
 static uint_fast32_t count_set_bits(DWORD_PTR mask)
 {
@@ -93,6 +114,23 @@ static uint_fast32_t detect_processor_count_ex(const bool logical_cores)
 	return processor_core_count;
 }
 
+static uint_fast32_t detect_processor_count_groups(void)
+{
+	const HMODULE kernel32 = GetModuleHandleW(L"kernel32");
+	if (!kernel32)
+	{
+		return 0U; /*unsupported*/
+	}
+
+	const GET_ACTIVE_PROCCOUNT get_active_proccount = (GET_ACTIVE_PROCCOUNT) GetProcAddress(kernel32, "GetActiveProcessorCount");
+	if (!get_active_proccount)
+	{
+		return 0U; /*unsupported*/
+	}
+
+	return get_active_proccount(0xFFFF); /*ALL_PROCESSOR_GROUPS, the other functions only see the current group*/
+}
+
 static uint_fast32_t detect_processor_count(void)
 {
 	DWORD_PTR maskProcess, maskSystem;
@@ -105,10 +143,248 @@ static uint_fast32_t detect_processor_count(void)
 
 uint_fast32_t get_processor_count(const bool logical_cores)
 {
-	uint_fast32_t count = detect_processor_count_ex(logical_cores);
+	uint_fast32_t count = logical_cores ? detect_processor_count_groups() : 0U;
+	if (!count)
+	{
+		count = detect_processor_count_ex(logical_cores);
+	}
 	if (!count)
 	{
 		count = detect_processor_count();
 	}
 	return count ? count : 1U;
 }
+
+#else //_WIN32
+
+#ifdef __linux__
+
+#define MAX_CPU_COUNT 65536U
+
+static cpu_set_t *get_affinity_mask(size_t *const set_size)
+{
+	for (uint_fast32_t cpu_count = 1024U; cpu_count <= MAX_CPU_COUNT; cpu_count *= 2U)
+	{
+		cpu_set_t *const cpu_set = CPU_ALLOC(cpu_count);
+		if (!cpu_set)
+		{
+			return NULL;
+		}
+		*set_size = CPU_ALLOC_SIZE(cpu_count);
+		if (!sched_getaffinity(0, *set_size, cpu_set))
+		{
+			return cpu_set;
+		}
+		CPU_FREE(cpu_set);
+		if (errno != EINVAL)
+		{
+			break; /*the mask was not too small*/
+		}
+	}
+	return NULL;
+}
+
+static bool cpu_list_contains(const char *list, const uint_fast32_t cpu)
+{
+	for (;;)
+	{
+		char *next;
+		const unsigned long first = strtoul(list, &next, 10);
+		if (next == list)
+		{
+			return false;
+		}
+		unsigned long last = first;
+		if (*next == '-')
+		{
+			list = next + 1U;
+			last = strtoul(list, &next, 10);
+		}
+		if ((cpu >= first) && (cpu <= last))
+		{
+			return true;
+		}
+		if (*next != ',')
+		{
+			return false;
+		}
+		list = next + 1U;
+	}
+}
+
+/* A physical core is counted once, at the first of its hardware threads that the process may run on */
+static bool is_first_sibling(const uint_fast32_t cpu, const cpu_set_t *const cpu_set, const size_t set_size)
+{
+	char path[96U], siblings[256U];
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%lu/topology/thread_siblings_list", (unsigned long)cpu);
+	FILE *const file = fopen(path, "r");
+	if (!file)
+	{
+		return true; /*topology is unknown*/
+	}
+	const bool valid = (fgets(siblings, sizeof(siblings), file) != NULL);
+	fclose(file);
+	if (!valid)
+	{
+		return true;
+	}
+	for (uint_fast32_t other = 0U; other < cpu; ++other)
+	{
+		if (CPU_ISSET_S(other, set_size, cpu_set) && cpu_list_contains(siblings, other))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static uint_fast32_t detect_processor_count_affinity(const bool logical_cores)
+{
+	size_t set_size = 0U;
+	cpu_set_t *const cpu_set = get_affinity_mask(&set_size);
+	if (!cpu_set)
+	{
+		return 0U; /*failed*/
+	}
+
+	uint_fast32_t processor_count = 0U;
+	for (uint_fast32_t cpu = 0U; cpu < 8U * set_size; ++cpu)
+	{
+		if (CPU_ISSET_S(cpu, set_size, cpu_set))
+		{
+			if (logical_cores || is_first_sibling(cpu, cpu_set, set_size))
+			{
+				++processor_count;
+			}
+		}
+	}
+
+	CPU_FREE(cpu_set);
+	return processor_count;
+}
+
+static uint_fast32_t read_cgroup_quota(const char *const cgroup_path)
+{
+	char path[512U];
+	unsigned long long quota = 0U, period = 0U;
+
+	//cgroup v2: "cpu.max" contains the quota ("max" for none) and the period
+	snprintf(path, sizeof(path), "/sys/fs/cgroup%s/cpu.max", cgroup_path);
+	FILE *file = fopen(path, "r");
+	if (file)
+	{
+		const int fields = fscanf(file, "%llu %llu", &quota, &period);
+		fclose(file);
+		return ((fields == 2) && quota && period) ? (uint_fast32_t)((quota + period - 1U) / period) : 0U;
+	}
+
+	//cgroup v1: the quota is -1 for none
+	long long quota_v1 = -1;
+	snprintf(path, sizeof(path), "/sys/fs/cgroup/cpu%s/cpu.cfs_quota_us", cgroup_path);
+	if ((file = fopen(path, "r")))
+	{
+		if (fscanf(file, "%lld", &quota_v1) != 1)
+		{
+			quota_v1 = -1;
+		}
+		fclose(file);
+	}
+	snprintf(path, sizeof(path), "/sys/fs/cgroup/cpu%s/cpu.cfs_period_us", cgroup_path);
+	if ((quota_v1 > 0) && (file = fopen(path, "r")))
+	{
+		if (fscanf(file, "%llu", &period) != 1)
+		{
+			period = 0U;
+		}
+		fclose(file);
+		return period ? (uint_fast32_t)(((unsigned long long)quota_v1 + period - 1U) / period) : 0U;
+	}
+
+	return 0U;
+}
+
+static bool has_cpu_controller(const char *controllers)
+{
+	for (;;)
+	{
+		const size_t length = strcspn(controllers, ",");
+		if ((length == 3U) && (!strncmp(controllers, "cpu", 3U)))
+		{
+			return true;
+		}
+		if (controllers[length] != ',')
+		{
+			return false;
+		}
+		controllers += length + 1U;
+	}
+}
+
+static uint_fast32_t detect_processor_count_cgroup(void)
+{
+	//Look up the cgroup of the process (v1 "cpu" controller, or else the v2 hierarchy); in a container, this is usually the root
+	char line[512U], cgroup_path[448U] = "";
+	FILE *const file = fopen("/proc/self/cgroup", "r");
+	if (file)
+	{
+		while (fgets(line, sizeof(line), file))
+		{
+			char *const controllers = strchr(line, ':');
+			char *const path = controllers ? strchr(controllers + 1U, ':') : NULL;
+			if (!path)
+			{
+				continue;
+			}
+			*path = '\0';
+			const bool is_v1_cpu = has_cpu_controller(controllers + 1U);
+			if (is_v1_cpu || (!controllers[1U]))
+			{
+				const size_t length = strcspn(path + 1U, "\r\n");
+				if (length < sizeof(cgroup_path))
+				{
+					memcpy(cgroup_path, path + 1U, length);
+					cgroup_path[length] = '\0';
+				}
+				if (is_v1_cpu)
+				{
+					break;
+				}
+			}
+		}
+		fclose(file);
+	}
+
+	//The limit may also be set on the root of the cgroup hierarchy that is visible to us
+	const uint_fast32_t quota = (cgroup_path[0U] && strcmp(cgroup_path, "/")) ? read_cgroup_quota(cgroup_path) : 0U;
+	return quota ? quota : read_cgroup_quota("");
+}
+
+#endif //__linux__
+
+static uint_fast32_t detect_processor_count(void)
+{
+	const long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return (count > 0L) ? (uint_fast32_t)count : 0U;
+}
+
+uint_fast32_t get_processor_count(const bool logical_cores)
+{
+	uint_fast32_t count = 0U;
+#ifdef __linux__
+	count = detect_processor_count_affinity(logical_cores);
+#endif
+	if (!count)
+	{
+		count = detect_processor_count();
+	}
+#ifdef __linux__
+	const uint_fast32_t quota = detect_processor_count_cgroup();
+	if (quota && (quota < count))
+	{
+		count = quota;
+	}
+#endif
+	return count ? count : 1U;
+}
+
+#endif //_WIN32
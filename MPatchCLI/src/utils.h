@@ -32,6 +32,11 @@ static __forceinline uint_fast32_t max_uint32(const uint_fast32_t a, const uint_
 	return (a > b) ? a : b;
 }
 
+static __forceinline uint64_t max_uint64(const uint64_t a, const uint64_t b)
+{
+	return (a > b) ? a : b;
+}
+
 static __forceinline uint_fast32_t min_uint32(const uint_fast32_t a, const uint_fast32_t b)
 {
 	return (a < b) ? a : b;
@@ -52,7 +57,7 @@ static __forceinline uint64_t diff_uint64(const uint64_t a, const uint64_t b)
 	return (a > b) ? (a - b) : (b - a);
 }
 
-static __forceinline uint32_t log10_uint32(uint32_t value)
+static __forceinline uint32_t log10_uint64(uint64_t value)
 {
 	uint32_t ret = 1U;
 	while (value /= 10U)
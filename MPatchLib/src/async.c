@@ -0,0 +1,215 @@
+/* ---------------------------------------------------------------------------------------------- */
+/* MPatchLib - patch and compression library                                                      */
+/* Copyright(c) 2018 LoRd_MuldeR <mulder2@gmx.de>                                                 */
+/*                                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy of this software  */
+/* and associated documentation files (the "Software"), to deal in the Software without           */
+/* restriction, including without limitation the rights to use, copy, modify, merge, publish,     */
+/* distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the  */
+/* Software is furnished to do so, subject to the following conditions:                           */
+/*                                                                                                */
+/* The above copyright notice and this permission notice shall be included in all copies or       */
+/* substantial portions of the Software.                                                          */
+/*                                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING  */
+/* BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND     */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,   */
+/* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.        */
+/* ---------------------------------------------------------------------------------------------- */
+
+#include "async.h"
+
+#ifdef _MSC_VER
+#define HAVE_STRUCT_TIMESPEC
+#endif
+
+#include <pthread.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Each job runs on a thread of its own, so that it does not occupy a thread of the (possibly shared) pool while waiting
+ * for the pool. The job function polls the cancellation token in all of its long-running loops, hence a cancelled job
+ * finishes within a few milliseconds. The completion handler is invoked on the job's thread, right before the job is
+ * reported as done; after mpatch_async_wait() has returned, the handler is guaranteed to have completed. The handler may
+ * destroy the job (but not wait for it), then the job's thread is detached and frees the job once the handler returns.
+ */
+
+struct async_job
+{
+	pthread_t thread;
+	pthread_t self; /*set by the job's thread itself, as "thread" may not have been stored yet when it starts*/
+	bool running;
+	bool detached;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_done;
+	cancel_token_t cancel;
+	async_func_t func;
+	void *data;
+	mpatch_completion_t completion;
+	mpatch_error_t result;
+	bool done;
+};
+
+/* ======================================================================= */
+/* Thread function                                                         */
+/* ======================================================================= */
+
+static void free_job(async_job_t *const job)
+{
+	pthread_cond_destroy(&job->cond_done);
+	pthread_mutex_destroy(&job->mutex);
+	free(job->data);
+	free(job);
+}
+
+static void *async_thread(void *const args)
+{
+	async_job_t *const job = (async_job_t*)args;
+
+	pthread_mutex_lock(&job->mutex);
+	job->self = pthread_self();
+	job->running = true;
+	pthread_mutex_unlock(&job->mutex);
+
+	//Run the job
+	const mpatch_error_t result = job->func((uintptr_t)job->data, &job->cancel);
+
+	//Invoke the completion handler, if it has destroyed the job, then the job is ours to free
+	if (job->completion.completion_func)
+	{
+		job->completion.completion_func(result, job->completion.user_data);
+		if (job->detached)
+		{
+			free_job(job);
+			return NULL;
+		}
+	}
+
+	//Report the job as done
+	pthread_mutex_lock(&job->mutex);
+	job->result = result;
+	job->done = true;
+	pthread_cond_broadcast(&job->cond_done);
+	pthread_mutex_unlock(&job->mutex);
+
+	return NULL;
+}
+
+/* ======================================================================= */
+/* Public functions                                                        */
+/* ======================================================================= */
+
+bool mpatch_async_start(async_job_t **const job, const async_func_t func, const void *const data, const size_t data_size, const mpatch_completion_t *const completion)
+{
+	if ((!job) || (!func) || (!data) || (data_size < 1U))
+	{
+		return false;
+	}
+
+	*job = NULL;
+
+	async_job_t *const j = (async_job_t*)calloc(1U, sizeof(async_job_t));
+	if (!j)
+	{
+		return false;
+	}
+
+	if (!(j->data = malloc(data_size)))
+	{
+		free(j);
+		return false;
+	}
+
+	memcpy(j->data, data, data_size);
+	j->func = func;
+	if (completion)
+	{
+		j->completion = *completion;
+	}
+
+	if (pthread_mutex_init(&j->mutex, NULL))
+	{
+		free(j->data);
+		free(j);
+		return false;
+	}
+
+	if (pthread_cond_init(&j->cond_done, NULL))
+	{
+		pthread_mutex_destroy(&j->mutex);
+		free(j->data);
+		free(j);
+		return false;
+	}
+
+	if (pthread_create(&j->thread, NULL, async_thread, j))
+	{
+		free_job(j);
+		return false;
+	}
+
+	*job = j;
+	return true;
+}
+
+bool mpatch_async_poll(async_job_t *const job, mpatch_error_t *const result)
+{
+	pthread_mutex_lock(&job->mutex);
+	const bool done = job->done;
+	if (done && result)
+	{
+		*result = job->result;
+	}
+	pthread_mutex_unlock(&job->mutex);
+	return done;
+}
+
+mpatch_error_t mpatch_async_wait(async_job_t *const job)
+{
+	pthread_mutex_lock(&job->mutex);
+	while (!job->done)
+	{
+		pthread_cond_wait(&job->cond_done, &job->mutex);
+	}
+	const mpatch_error_t result = job->result;
+	pthread_mutex_unlock(&job->mutex);
+	return result;
+}
+
+void mpatch_async_cancel(async_job_t *const job)
+{
+	set_cancelled(&job->cancel);
+}
+
+bool mpatch_async_destroy(async_job_t **const job)
+{
+	if ((!job) || (!(*job)))
+	{
+		return false;
+	}
+
+	async_job_t *const j = *job;
+	*job = NULL;
+
+	//Called by the completion handler? The thread can not join itself, so it frees the job once the handler returns
+	pthread_mutex_lock(&j->mutex);
+	const bool own_thread = j->running && pthread_equal(j->self, pthread_self());
+	pthread_mutex_unlock(&j->mutex);
+	if (own_thread)
+	{
+		j->detached = true;
+		return !pthread_detach(pthread_self());
+	}
+
+	bool success = true;
+	if (pthread_join(j->thread, NULL))
+	{
+		success = false;
+	}
+
+	free_job(j);
+	return success;
+}
@@ -0,0 +1,37 @@
+/* ---------------------------------------------------------------------------------------------- */
+/* MPatchLib - patch and compression library                                                      */
+/* Copyright(c) 2018 LoRd_MuldeR <mulder2@gmx.de>                                                 */
+/*                                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy of this software  */
+/* and associated documentation files (the "Software"), to deal in the Software without           */
+/* restriction, including without limitation the rights to use, copy, modify, merge, publish,     */
+/* distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the  */
+/* Software is furnished to do so, subject to the following conditions:                           */
+/*                                                                                                */
+/* The above copyright notice and this permission notice shall be included in all copies or       */
+/* substantial portions of the Software.                                                          */
+/*                                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING  */
+/* BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND     */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,   */
+/* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.        */
+/* ---------------------------------------------------------------------------------------------- */
+
+#ifndef _INC_MPATCH_ASYNC_H
+#define _INC_MPATCH_ASYNC_H 
+
+#include "libmpatch.h"
+#include "utils.h"
+
+typedef mpatch_error_t (*async_func_t)(const uintptr_t data, const cancel_token_t *const cancel);
+
+typedef struct async_job async_job_t;
+
+bool mpatch_async_start(async_job_t **const job, const async_func_t func, const void *const data, const size_t data_size, const mpatch_completion_t *const completion); /*"data" is copied*/
+bool mpatch_async_poll(async_job_t *const job, mpatch_error_t *const result);
+mpatch_error_t mpatch_async_wait(async_job_t *const job);
+void mpatch_async_cancel(async_job_t *const job);
+bool mpatch_async_destroy(async_job_t **const job);
+
+#endif /*_INC_MPATCH_ASYNC_H*/
@@ -24,6 +24,9 @@
 #include <stdint.h>
 #include <memory.h>
 
+#include "utils.h"
+#include "pool.h"
+
 #include "rhash/md5.h"
 #include "rhash/crc32.h"
 #include "rhash/version.h"
@@ -32,233 +35,501 @@
 /* Bit I/O                                                                 */
 /* ======================================================================= */
 
+#define IO_BUFFER_SIZE 65536U
+#define IO_HASH_PARALLEL 16384U
+
 static const uint8_t BIT_MASK[8U] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80 };
 
 typedef struct
 {
-	uint_fast8_t bit_pos;
-	uint8_t value;
-	uint32_t byte_counter;
+	uint64_t bit_buffer;
+	uint_fast32_t bit_count;
+	uint_fast32_t buffer_pos;
+	const uint8_t *input_ptr;
+	const uint8_t *input_end;
+	const uint8_t *hash_ptr;
+	uint64_t byte_counter;
 	md5_ctx md5_ctx;
 	uint32_t crc32_ctx;
+	thread_pool_t *hash_pool;
+	uint8_t buffer[IO_BUFFER_SIZE];
 }
 io_state_t;
 
 static inline void init_io_state(io_state_t *const state)
 {
 	memset(state, 0, sizeof(io_state_t));
+	state->input_ptr = state->input_end = state->hash_ptr = state->buffer;
 	mpatch_md5_init(&state->md5_ctx);
 	mpatch_crc32_init(&state->crc32_ctx);
-	state->bit_pos = UINT_FAST8_MAX;
 }
 
-static inline bool read_bit(bool *const value, const mpatch_reader_t *const input, io_state_t *const state)
+/*
+ * Input is taken from a window of bytes, which is either the internal buffer, refilled in large blocks by the reader
+ * function, or a complete input buffer that was attached via set_input_buffer() and is read without any callbacks. The
+ * 64-bit bit accumulator is refilled from the window whenever it runs low; bits are always consumed from the low end.
+ * Bits beyond the end of the input read as zero, but can never be consumed. The MD5 and CRC-32 checksums are updated
+ * lazily from the window, excluding the bytes that the accumulator has read ahead past the end of the stream.
+ */
+
+static inline void _hash_input(io_state_t *const state, const uint8_t *const data, const size_t len)
 {
-	if (state->bit_pos > 7U)
+	if (len)
 	{
-		if (!input->reader_func(&state->value, 1U, input->user_data))
-		{
-			*value = 0U;
-			return false;
-		}
-		state->bit_pos = 0U;
+		mpatch_md5_update(&state->md5_ctx, data, len);
+		mpatch_crc32_update(&state->crc32_ctx, data, len);
+		state->byte_counter += len;
 	}
-	*value = BOOLIFY(state->value & BIT_MASK[state->bit_pos++]);
-	return true;
 }
 
-static inline bool write_bit(const bool value, const mpatch_writer_t *const output, io_state_t *const state)
+static inline void set_input_buffer(io_state_t *const state, const uint8_t *const data, const uint64_t len)
+{
+	state->input_ptr = state->hash_ptr = data;
+	state->input_end = data + (size_t)len; /*the caller ensures that len fits into the address space*/
+}
+
+static inline uint64_t input_position(const io_state_t *const state)
+{
+	return state->byte_counter + (uint64_t)(state->input_ptr - state->hash_ptr) - (state->bit_count / 8U);
+}
+
+static inline uint64_t input_bit_position(const io_state_t *const state)
+{
+	return (8U * ((uint64_t)state->byte_counter + (uint64_t)(state->input_ptr - state->hash_ptr))) - state->bit_count;
+}
+
+static inline bool _refill_input(const mpatch_reader_t *const input, io_state_t *const state)
 {
-	if (state->bit_pos == UINT_FAST8_MAX)
+	if (!input->reader_func)
+	{
+		return false; /*attached buffer is exhausted*/
+	}
+
+	//Keep the last (up to) eight bytes, as they may still be pending in the accumulator
+	const uint8_t *const keep_ptr = ((state->input_ptr - state->hash_ptr) > 8) ? (state->input_ptr - 8U) : state->hash_ptr;
+	const uint_fast32_t keep_len = (uint_fast32_t)(state->input_ptr - keep_ptr);
+	_hash_input(state, state->hash_ptr, (size_t)(keep_ptr - state->hash_ptr));
+	if (keep_len)
 	{
-		state->bit_pos = 0U;
+		memmove(state->buffer, keep_ptr, keep_len);
 	}
-	if (value)
+
+	//Read the next block
+	const uint_fast32_t read_len = input->reader_func(state->buffer + keep_len, IO_BUFFER_SIZE - keep_len, input->user_data);
+	state->hash_ptr = state->buffer;
+	state->input_ptr = state->buffer + keep_len;
+	state->input_end = state->input_ptr + read_len;
+	return (read_len > 0U);
+}
+
+static inline void _refill_bits(const mpatch_reader_t *const input, io_state_t *const state)
+{
+	//Fast path: Insert eight bytes at once, the bytes beyond the whole ones are re-inserted by the next refill
+	if ((state->input_end - state->input_ptr) >= 8)
 	{
-		state->value |= BIT_MASK[state->bit_pos];
+		const uint8_t *const ptr = state->input_ptr;
+		state->bit_buffer |= (((uint64_t)ptr[0U]) | (((uint64_t)ptr[1U]) << 8U) | (((uint64_t)ptr[2U]) << 16U) | (((uint64_t)ptr[3U]) << 24U) |
+			(((uint64_t)ptr[4U]) << 32U) | (((uint64_t)ptr[5U]) << 40U) | (((uint64_t)ptr[6U]) << 48U) | (((uint64_t)ptr[7U]) << 56U)) << state->bit_count;
+		const uint_fast32_t count = (63U - state->bit_count) >> 3U;
+		state->input_ptr += count;
+		state->bit_count += count << 3U;
+		return;
 	}
-	if (++state->bit_pos > 7U)
+
+	//Slow path: Near the end of the window
+	while (state->bit_count <= 56U)
 	{
-		if (!output->writer_func(&state->value, 1U, output->user_data))
+		if ((state->input_ptr >= state->input_end) && (!_refill_input(input, state)))
 		{
-			return false;
-		
+			break; /*end of input*/
 		}
-		mpatch_md5_update(&state->md5_ctx, &state->value, 1U);
-		mpatch_crc32_update(&state->crc32_ctx, &state->value, 1U);
-		state->byte_counter++;
-		state->bit_pos = state->value = 0U;
+		state->bit_buffer |= ((uint64_t)(*state->input_ptr++)) << state->bit_count;
+		state->bit_count += 8U;
 	}
-	return true;
 }
 
-static inline bool read_byte(uint8_t *const value, const mpatch_reader_t *const input, io_state_t *const state)
+static __forceinline bool read_bits(uint32_t *const value, const uint_fast32_t nbits, const mpatch_reader_t *const input, io_state_t *const state)
 {
-	if (state->bit_pos > 7U)
+	if (state->bit_count < nbits)
 	{
-		if (!input->reader_func(&state->value, 1U, input->user_data))
+		_refill_bits(input, state);
+		if (state->bit_count < nbits)
 		{
 			*value = 0U;
 			return false;
 		}
-		state->bit_pos = 0U;
 	}
-	*value = (state->value >> state->bit_pos);
-	if (state->bit_pos)
+	*value = (uint32_t)(state->bit_buffer & ((((uint64_t)1U) << nbits) - 1U));
+	state->bit_buffer >>= nbits;
+	state->bit_count -= nbits;
+	return true;
+}
+
+static __forceinline bool read_bit(bool *const value, const mpatch_reader_t *const input, io_state_t *const state)
+{
+	uint32_t temp;
+	const bool success = read_bits(&temp, 1U, input, state);
+	*value = BOOLIFY(temp);
+	return success;
+}
+
+static __forceinline bool read_byte(uint8_t *const value, const mpatch_reader_t *const input, io_state_t *const state)
+{
+	uint32_t temp;
+	const bool success = read_bits(&temp, 8U, input, state);
+	*value = (uint8_t)temp;
+	return success;
+}
+
+static inline bool skip_bits(uint64_t nbits, const mpatch_reader_t *const input, io_state_t *const state)
+{
+	uint32_t value;
+	while (nbits)
 	{
-		if (!input->reader_func(&state->value, 1U, input->user_data))
+		const uint_fast32_t count = (nbits > 32U) ? 32U : (uint_fast32_t)nbits;
+		if (!read_bits(&value, count, input, state))
 		{
-			*value = 0U;
 			return false;
 		}
-		*value |= (state->value << (8U - state->bit_pos));
+		nbits -= count;
 	}
-	else
+	return true;
+}
+
+static inline bool _copy_input(uint8_t *data, uint_fast32_t len, const mpatch_reader_t *const input, io_state_t *const state)
+{
+	while (len)
 	{
-		state->bit_pos = 8U;
+		if ((state->input_ptr >= state->input_end) && (!_refill_input(input, state)))
+		{
+			return false;
+		}
+		const uint_fast32_t chunk_len = min_uint32(len, (uint_fast32_t)(state->input_end - state->input_ptr));
+		memcpy(data, state->input_ptr, chunk_len);
+		state->input_ptr += chunk_len;
+		data += chunk_len;
+		len -= chunk_len;
 	}
 	return true;
 }
 
-static inline bool write_byte(const uint8_t value, const mpatch_writer_t *const output, io_state_t *const state)
+static inline bool read_bytes(uint8_t *data, uint_fast32_t len, const mpatch_reader_t *const input, io_state_t *const state)
 {
-	if (state->bit_pos == UINT_FAST8_MAX)
+	if (state->bit_count & 7U)
+	{
+		for (uint32_t value; len >= 4U; data += 4U, len -= 4U)
+		{
+			if (!read_bits(&value, 32U, input, state))
+			{
+				return false;
+			}
+			data[0U] = (uint8_t)(value);
+			data[1U] = (uint8_t)(value >>  8U);
+			data[2U] = (uint8_t)(value >> 16U);
+			data[3U] = (uint8_t)(value >> 24U);
+		}
+		for (; len; ++data, --len)
+		{
+			if (!read_byte(data, input, state))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+	for (; len && state->bit_count; ++data, --len)
 	{
-		state->bit_pos = 0U;
+		*data = (uint8_t)state->bit_buffer;
+		state->bit_buffer >>= 8U;
+		state->bit_count -= 8U;
 	}
-	state->value |= (value << state->bit_pos);
-	if (!output->writer_func(&state->value, 1U, output->user_data))
+	if (len)
 	{
-		return false;
+		state->bit_buffer = 0U; /*discard read-ahead bits, the window is consumed directly*/
+		return _copy_input(data, len, input, state);
 	}
-	mpatch_md5_update(&state->md5_ctx, &state->value, 1U);
-	mpatch_crc32_update(&state->crc32_ctx, &state->value, 1U);
-	state->byte_counter++;
-	state->value = (value >> (8U - state->bit_pos));
 	return true;
 }
 
-static inline bool write_bytes(const uint8_t *data, const uint_fast32_t len, const mpatch_writer_t *const output, io_state_t *const state)
+static inline void finish_state(io_state_t *const state)
+{
+	state->input_ptr -= state->bit_count / 8U;
+	_hash_input(state, state->hash_ptr, (size_t)(state->input_ptr - state->hash_ptr));
+	state->hash_ptr = state->input_ptr;
+	state->bit_buffer = 0U;
+	state->bit_count = 0U;
+}
+
+static inline bool align_input(io_state_t *const state)
+{
+	const uint_fast32_t nbits = state->bit_count & 7U;
+	const bool padding = !(state->bit_buffer & ((((uint64_t)1U) << nbits) - 1U));
+	state->bit_buffer >>= nbits;
+	state->bit_count -= nbits;
+	return padding; /*padding bits must be zero*/
+}
+
+static inline bool read_raw_bytes(uint8_t *data, const uint_fast32_t len, const mpatch_reader_t *const input, io_state_t *const state)
+{
+	state->hash_ptr = state->input_ptr; /*requires an empty accumulator*/
+	const bool success = _copy_input(data, len, input, state);
+	state->hash_ptr = state->input_ptr; /*raw bytes are not hashed*/
+	return success;
+}
+
+/*
+ * Output is collected in a 64-bit bit accumulator, which is spilled to the internal buffer 32 bits at a time. The buffer
+ * is passed to the writer function (and the MD5 and CRC-32 checksums are updated) only when it is full or at flush time.
+ * If a "hash_pool" is set, the MD5 and CRC-32 updates of large blocks run concurrently on two of the pool's threads.
+ */
+
+static void _hash_block_md5(const uintptr_t user_data)
+{
+	io_state_t *const state = (io_state_t*)user_data;
+	mpatch_md5_update(&state->md5_ctx, state->buffer, state->buffer_pos);
+}
+
+static void _hash_block_crc32(const uintptr_t user_data)
 {
-	for (uint32_t i = 0U; i < len; ++i)
+	io_state_t *const state = (io_state_t*)user_data;
+	mpatch_crc32_update(&state->crc32_ctx, state->buffer, state->buffer_pos);
+}
+
+static inline bool _flush_buffer(const mpatch_writer_t *const output, io_state_t *const state)
+{
+	if (state->buffer_pos)
 	{
-		if (!write_byte(data[i], output, state))
+		if (!output->writer_func(state->buffer, state->buffer_pos, output->user_data))
 		{
 			return false;
 		}
+		if (state->hash_pool && (state->hash_pool->thread_count > 1U) && (state->buffer_pos >= IO_HASH_PARALLEL))
+		{
+			const pool_task_t task_queue[2U] = { { _hash_block_md5, (uintptr_t)state }, { _hash_block_crc32, (uintptr_t)state } };
+			mpatch_pool_exec(state->hash_pool, task_queue, 2U);
+		}
+		else
+		{
+			_hash_block_md5((uintptr_t)state);
+			_hash_block_crc32((uintptr_t)state);
+		}
+		state->byte_counter += state->buffer_pos;
+		state->buffer_pos = 0U;
 	}
 	return true;
 }
 
-static inline bool flush_state(const mpatch_writer_t *const output, io_state_t *const state)
+static inline bool _drain_bits(const mpatch_writer_t *const output, io_state_t *const state)
 {
-	if ((state->bit_pos > 0U) && (state->bit_pos != UINT_FAST8_MAX))
+	while (state->bit_count >= 8U)
 	{
-		if (!output->writer_func(&state->value, 1U, output->user_data))
+		if (state->buffer_pos >= IO_BUFFER_SIZE)
 		{
-			return false;
+			if (!_flush_buffer(output, state))
+			{
+				return false;
+			}
 		}
-		mpatch_md5_update(&state->md5_ctx, &state->value, 1U);
-		mpatch_crc32_update(&state->crc32_ctx, &state->value, 1U);
-		state->byte_counter++;
-		state->bit_pos = state->value = 0U;
+		state->buffer[state->buffer_pos++] = (uint8_t)state->bit_buffer;
+		state->bit_buffer >>= 8U;
+		state->bit_count -= 8U;
 	}
 	return true;
 }
 
-/* ======================================================================= */
-/* Exponential Golomb                                                      */
-/* ======================================================================= */
+static __forceinline bool write_bits(const uint32_t value, const uint_fast32_t nbits, const mpatch_writer_t *const output, io_state_t *const state)
+{
+	state->bit_buffer |= ((uint64_t)value) << state->bit_count;
+	if ((state->bit_count += nbits) >= 32U)
+	{
+		if (state->buffer_pos > (IO_BUFFER_SIZE - 4U))
+		{
+			if (!_flush_buffer(output, state))
+			{
+				return false;
+			}
+		}
+		uint8_t *const ptr = state->buffer + state->buffer_pos;
+		ptr[0U] = (uint8_t)(state->bit_buffer);
+		ptr[1U] = (uint8_t)(state->bit_buffer >>  8U);
+		ptr[2U] = (uint8_t)(state->bit_buffer >> 16U);
+		ptr[3U] = (uint8_t)(state->bit_buffer >> 24U);
+		state->buffer_pos += 4U;
+		state->bit_buffer >>= 32U;
+		state->bit_count -= 32U;
+	}
+	return true;
+}
 
-typedef struct
+static __forceinline bool write_bit(const bool value, const mpatch_writer_t *const output, io_state_t *const state)
 {
-	uint_fast32_t val;
-	uint_fast32_t len;
+	return write_bits(value ? 1U : 0U, 1U, output, state);
 }
-exp_golomb_size_t;
 
-static const uint_fast32_t EXP_GOLOMB_SIZE[128] =
+static __forceinline bool write_byte(const uint8_t value, const mpatch_writer_t *const output, io_state_t *const state)
 {
-	0x1, 0x3, 0x5, 0x5, 0x7, 0x7, 0x7, 0x7, 0x9, 0x9, 0x9, 0x9, 0x9, 0x9, 0x9, 0x9,
-	0xB, 0xB, 0xB, 0xB, 0xB, 0xB, 0xB, 0xB, 0xB, 0xB, 0xB, 0xB, 0xB, 0xB, 0xB, 0xB,
-	0xD, 0xD, 0xD, 0xD, 0xD, 0xD, 0xD, 0xD, 0xD, 0xD, 0xD, 0xD, 0xD, 0xD, 0xD, 0xD,
-	0xD, 0xD, 0xD, 0xD, 0xD, 0xD, 0xD, 0xD, 0xD, 0xD, 0xD, 0xD, 0xD, 0xD, 0xD, 0xD,
-	0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF,
-	0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF,
-	0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF,
-	0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF
-};
+	return write_bits(value, 8U, output, state);
+}
 
-static inline uint_fast32_t exp_golomb_size(uint_fast32_t value)
+static inline bool write_bytes(const uint8_t *data, uint64_t len, const mpatch_writer_t *const output, io_state_t *const state)
 {
-	if (value < 128U)
+	if (state->bit_count & 7U)
 	{
-		return EXP_GOLOMB_SIZE[value];
-	}
-	else
-	{
-		uint_fast32_t bit_size = 1U;
-		while (value)
+		for (; len >= 4U; data += 4U, len -= 4U)
+		{
+			if (!write_bits(((uint32_t)data[0U]) | (((uint32_t)data[1U]) << 8U) | (((uint32_t)data[2U]) << 16U) | (((uint32_t)data[3U]) << 24U), 32U, output, state))
+			{
+				return false;
+			}
+		}
+		for (; len; ++data, --len)
 		{
-			bit_size += 2U;
-			value >>= 1U;
+			if (!write_bits(*data, 8U, output, state))
+			{
+				return false;
+			}
 		}
-		return bit_size;
+		return true;
 	}
-}
-
-static inline bool exp_golomb_write(uint_fast32_t value, const mpatch_writer_t *const output, io_state_t *const state)
-{
-	uint_fast32_t nbits = 0U, temp = 0U;
-	while (value)
+	if (!_drain_bits(output, state))
 	{
-		temp = (temp << 1U) | (value & 1U);
-		++nbits;
-		value >>= 1U;
+		return false;
 	}
-	if (nbits)
+	while (len)
 	{
-		do
+		if (state->buffer_pos >= IO_BUFFER_SIZE)
 		{
-			if (!(write_bit(true, output, state) && write_bit(temp & 1U, output, state)))
+			if (!_flush_buffer(output, state))
 			{
 				return false;
 			}
-			temp >>= 1U;
 		}
-		while (--nbits);
+		const uint_fast32_t chunk_len = (uint_fast32_t)min_uint64(len, IO_BUFFER_SIZE - state->buffer_pos);
+		memcpy(state->buffer + state->buffer_pos, data, chunk_len);
+		state->buffer_pos += chunk_len;
+		data += chunk_len;
+		len -= chunk_len;
 	}
-	if (!write_bit(false, output, state))
+	return true;
+}
+
+static inline void align_output(io_state_t *const state)
+{
+	state->bit_count = (state->bit_count + 7U) & (~((uint_fast32_t)7U));
+}
+
+static inline uint64_t output_stream_position(const io_state_t *const state)
+{
+	return state->byte_counter + state->buffer_pos + (state->bit_count / 8U);
+}
+
+static inline bool flush_state(const mpatch_writer_t *const output, io_state_t *const state)
+{
+	align_output(state);
+	return _drain_bits(output, state) && _flush_buffer(output, state);
+}
+
+/* ======================================================================= */
+/* Exponential Golomb                                                      */
+/* ======================================================================= */
+
+/*
+ * A value of n significant bits is coded as n pairs of bits, each a "1" flag followed by the next value bit (starting at
+ * the MSB), terminated by a single "0" flag. The writer builds the code word by bit-reversal and interleaving, so a value
+ * of up to 15 bits is inserted at once. The reader peeks 32 bits, which hold a complete code of up to 15 value bits: the
+ * terminating flag is located by counting the trailing "1" flags, and the value bits are gathered from the four bytes of
+ * the peek through EXP_GOLOMB_LUT, which maps a byte to its four value bits (first bit in the MSB). No branch depends on
+ * the length of the code. Values are 64-bit, because offsets and lengths may exceed the 32-bit range.
+ */
+
+static const uint8_t EXP_GOLOMB_LUT[256U] =
+{
+	0x00, 0x00, 0x08, 0x08, 0x00, 0x00, 0x08, 0x08, 0x04, 0x04, 0x0C, 0x0C, 0x04, 0x04, 0x0C, 0x0C,
+	0x00, 0x00, 0x08, 0x08, 0x00, 0x00, 0x08, 0x08, 0x04, 0x04, 0x0C, 0x0C, 0x04, 0x04, 0x0C, 0x0C,
+	0x02, 0x02, 0x0A, 0x0A, 0x02, 0x02, 0x0A, 0x0A, 0x06, 0x06, 0x0E, 0x0E, 0x06, 0x06, 0x0E, 0x0E,
+	0x02, 0x02, 0x0A, 0x0A, 0x02, 0x02, 0x0A, 0x0A, 0x06, 0x06, 0x0E, 0x0E, 0x06, 0x06, 0x0E, 0x0E,
+	0x00, 0x00, 0x08, 0x08, 0x00, 0x00, 0x08, 0x08, 0x04, 0x04, 0x0C, 0x0C, 0x04, 0x04, 0x0C, 0x0C,
+	0x00, 0x00, 0x08, 0x08, 0x00, 0x00, 0x08, 0x08, 0x04, 0x04, 0x0C, 0x0C, 0x04, 0x04, 0x0C, 0x0C,
+	0x02, 0x02, 0x0A, 0x0A, 0x02, 0x02, 0x0A, 0x0A, 0x06, 0x06, 0x0E, 0x0E, 0x06, 0x06, 0x0E, 0x0E,
+	0x02, 0x02, 0x0A, 0x0A, 0x02, 0x02, 0x0A, 0x0A, 0x06, 0x06, 0x0E, 0x0E, 0x06, 0x06, 0x0E, 0x0E,
+	0x01, 0x01, 0x09, 0x09, 0x01, 0x01, 0x09, 0x09, 0x05, 0x05, 0x0D, 0x0D, 0x05, 0x05, 0x0D, 0x0D,
+	0x01, 0x01, 0x09, 0x09, 0x01, 0x01, 0x09, 0x09, 0x05, 0x05, 0x0D, 0x0D, 0x05, 0x05, 0x0D, 0x0D,
+	0x03, 0x03, 0x0B, 0x0B, 0x03, 0x03, 0x0B, 0x0B, 0x07, 0x07, 0x0F, 0x0F, 0x07, 0x07, 0x0F, 0x0F,
+	0x03, 0x03, 0x0B, 0x0B, 0x03, 0x03, 0x0B, 0x0B, 0x07, 0x07, 0x0F, 0x0F, 0x07, 0x07, 0x0F, 0x0F,
+	0x01, 0x01, 0x09, 0x09, 0x01, 0x01, 0x09, 0x09, 0x05, 0x05, 0x0D, 0x0D, 0x05, 0x05, 0x0D, 0x0D,
+	0x01, 0x01, 0x09, 0x09, 0x01, 0x01, 0x09, 0x09, 0x05, 0x05, 0x0D, 0x0D, 0x05, 0x05, 0x0D, 0x0D,
+	0x03, 0x03, 0x0B, 0x0B, 0x03, 0x03, 0x0B, 0x0B, 0x07, 0x07, 0x0F, 0x0F, 0x07, 0x07, 0x0F, 0x0F,
+	0x03, 0x03, 0x0B, 0x0B, 0x03, 0x03, 0x0B, 0x0B, 0x07, 0x07, 0x0F, 0x0F, 0x07, 0x07, 0x0F, 0x0F
+};
+
+static __forceinline uint32_t _reverse_uint16(uint32_t x)
+{
+	x = ((x >> 1U) & 0x5555U) | ((x & 0x5555U) << 1U);
+	x = ((x >> 2U) & 0x3333U) | ((x & 0x3333U) << 2U);
+	x = ((x >> 4U) & 0x0F0FU) | ((x & 0x0F0FU) << 4U);
+	return ((x >> 8U) & 0x00FFU) | ((x & 0x00FFU) << 8U);
+}
+
+static __forceinline uint32_t _exp_golomb_code(const uint32_t bits, const uint_fast32_t count)
+{
+	uint32_t x = _reverse_uint16(bits) >> (16U - count);
+	x = (x | (x << 8U)) & 0x00FF00FFU;
+	x = (x | (x << 4U)) & 0x0F0F0F0FU;
+	x = (x | (x << 2U)) & 0x33333333U;
+	x = (x | (x << 1U)) & 0x55555555U;
+	return (x << 1U) | (0x55555555U >> (32U - (2U * count)));
+}
+
+static __forceinline uint32_t _exp_golomb_bits(const uint32_t code, const uint_fast32_t count)
+{
+	const uint32_t bits = (((uint32_t)EXP_GOLOMB_LUT[code & 0xFFU]) << 12U) | (((uint32_t)EXP_GOLOMB_LUT[(code >> 8U) & 0xFFU]) << 8U) | (((uint32_t)EXP_GOLOMB_LUT[(code >> 16U) & 0xFFU]) << 4U) | EXP_GOLOMB_LUT[code >> 24U];
+	return bits >> (16U - count);
+}
+
+static __forceinline uint_fast32_t exp_golomb_size(const uint64_t value)
+{
+	return (2U * bit_length_uint64(value)) + 1U;
+}
+
+static inline bool exp_golomb_write(const uint64_t value, const mpatch_writer_t *const output, io_state_t *const state)
+{
+	uint_fast32_t nbits = bit_length_uint64(value);
+	while (nbits > 15U)
 	{
-		return false;
+		const uint_fast32_t count = min_uint32(nbits - 15U, 16U);
+		nbits -= count;
+		if (!write_bits(_exp_golomb_code(((uint32_t)(value >> nbits)) & (0xFFFFU >> (16U - count)), count), 2U * count, output, state))
+		{
+			return false;
+		}
 	}
-	return true;
+	return write_bits(nbits ? _exp_golomb_code(((uint32_t)value) & ((1U << nbits) - 1U), nbits) : 0U, (2U * nbits) + 1U, output, state);
 }
 
-static inline int exp_golomb_read(uint_fast32_t *const value, const mpatch_reader_t *const input, io_state_t *const state)
+static inline bool exp_golomb_read(uint64_t *const value, const mpatch_reader_t *const input, io_state_t *const state)
 {
 	*value = 0U;
 	for (;;)
 	{
-		bool bitval;
-		if (!read_bit(&bitval, input, state))
+		if (state->bit_count < 32U)
 		{
-			return false;
+			_refill_bits(input, state);
 		}
-		if (bitval)
+		const uint32_t peek = (uint32_t)state->bit_buffer;
+		const uint_fast32_t nbits = trailing_zeros_uint32((~peek) & 0x55555555U) / 2U;
+		const uint_fast32_t code_len = (nbits < 16U) ? ((2U * nbits) + 1U) : 32U;
+		if (code_len > state->bit_count)
 		{
-			if (!read_bit(&bitval, input, state))
-			{
-				return false;
-			}
-			*value = (*value << 1U) | bitval;
+			return false;
 		}
-		else
+		*value = (*value << nbits) | _exp_golomb_bits(peek, nbits);
+		state->bit_buffer >>= code_len;
+		state->bit_count -= code_len;
+		if (nbits < 16U)
 		{
-			break; /*no more bits*/
+			return true;
 		}
 	}
-	return true;
 }
 
 #endif /*_INC_MPATCH_BITIO_H*/
\ No newline at end of file
@@ -0,0 +1,451 @@
+/* ---------------------------------------------------------------------------------------------- */
+/* MPatchLib - simple patch and compression library                                               */
+/* Copyright(c) 2018 LoRd_MuldeR <mulder2@gmx.de>                                                 */
+/*                                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy of this software  */
+/* and associated documentation files (the "Software"), to deal in the Software without           */
+/* restriction, including without limitation the rights to use, copy, modify, merge, publish,     */
+/* distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the  */
+/* Software is furnished to do so, subject to the following conditions:                           */
+/*                                                                                                */
+/* The above copyright notice and this permission notice shall be included in all copies or       */
+/* substantial portions of the Software.                                                          */
+/*                                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING  */
+/* BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND     */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,   */
+/* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.        */
+/* ---------------------------------------------------------------------------------------------- */
+
+#include "compress.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <malloc.h>
+#include <memory.h>
+
+/*
+ * Simple and fast byte-oriented LZ77 codec. Each block is a sequence of tokens, every token being made of a literal run
+ * and a back-reference into the history (i.e. the loaded dictionaries plus all preceding blocks). The last token of a
+ * block consists of literals only. Token layout: [LLLLMMMM] [lit_ext*] [literals] [offset_lo offset_hi] [match_ext*]
+ */
+
+#define LZ_HASH_BITS 14U
+#define LZ_HASH_SIZE (1U << LZ_HASH_BITS)
+#define LZ_WINDOW 65535U
+#define LZ_MIN_MATCH 4U
+#define LZ_RUN_MASK 15U
+#define LZ_SPARSE_EFFORT 2U /*from this effort on, positions inside of a match are not hashed*/
+#define LZ_OVERHEAD 8192U /*page rounding of the context and of the history, which are large enough to be mapped*/
+
+typedef struct
+{
+	uint8_t *buffer;
+	uint_fast32_t length, capacity;
+}
+lz_history_t;
+
+typedef struct
+{
+	lz_history_t history;
+	uint32_t hash_table[LZ_HASH_SIZE];
+	uint_fast32_t max_chunk_size, buffer_size;
+	uint8_t *buffer;
+	uint_fast32_t effort;
+	struct
+	{
+		const uint8_t *message_in;
+		uint_fast32_t message_size, compressed_size;
+	}
+	cache;
+}
+lz_enc_t;
+
+typedef struct
+{
+	lz_history_t history;
+	uint_fast32_t max_chunk_size;
+}
+lz_dec_t;
+
+/* ======================================================================= */
+/* Utility functions                                                       */
+/* ======================================================================= */
+
+static __forceinline uint32_t lz_hash(const uint8_t *const data)
+{
+	uint32_t value;
+	memcpy(&value, data, sizeof(uint32_t));
+	return (value * 2654435761U) >> (32U - LZ_HASH_BITS);
+}
+
+static bool lz_history_init(lz_history_t *const history, const uint_fast32_t max_chunk_size)
+{
+	history->length = 0U;
+	history->capacity = (2U * LZ_WINDOW) + max_chunk_size;
+	return BOOLIFY(history->buffer = (uint8_t*)malloc(history->capacity * sizeof(uint8_t)));
+}
+
+static uint_fast32_t lz_history_reserve(lz_history_t *const history, const uint_fast32_t size)
+{
+	if (history->length + size > history->capacity)
+	{
+		const uint_fast32_t shift = history->length - LZ_WINDOW;
+		memmove(history->buffer, history->buffer + shift, LZ_WINDOW);
+		history->length = LZ_WINDOW;
+		return shift;
+	}
+	return 0U;
+}
+
+static void lz_rebase_hash(uint32_t *const hash_table, const uint_fast32_t shift)
+{
+	if (shift)
+	{
+		for (uint_fast32_t i = 0U; i < LZ_HASH_SIZE; ++i)
+		{
+			hash_table[i] = (hash_table[i] > shift) ? (uint32_t)(hash_table[i] - shift) : 0U;
+		}
+	}
+}
+
+static uint8_t *lz_write_run(uint8_t *out_ptr, uint_fast32_t value)
+{
+	while (value >= 255U)
+	{
+		*out_ptr++ = 255U;
+		value -= 255U;
+	}
+	*out_ptr++ = (uint8_t)value;
+	return out_ptr;
+}
+
+static bool lz_read_run(uint_fast32_t *const value, const uint8_t *const in_ptr, uint_fast32_t *const in_pos, const uint_fast32_t in_len)
+{
+	uint8_t next;
+	do
+	{
+		if (*in_pos >= in_len)
+		{
+			return false;
+		}
+		*value += (next = in_ptr[(*in_pos)++]);
+	}
+	while (next == 255U);
+	return true;
+}
+
+static uint8_t *lz_write_token(uint8_t *out_ptr, const uint8_t *const literal, const uint_fast32_t literal_len, const uint_fast32_t offset, const uint_fast32_t match_len)
+{
+	uint8_t *const token = out_ptr++;
+	*token = (uint8_t)(min_uint32(literal_len, LZ_RUN_MASK) << 4U);
+	if (literal_len >= LZ_RUN_MASK)
+	{
+		out_ptr = lz_write_run(out_ptr, literal_len - LZ_RUN_MASK);
+	}
+	memcpy(out_ptr, literal, literal_len);
+	out_ptr += literal_len;
+	if (match_len)
+	{
+		*out_ptr++ = (uint8_t)(offset & 0xFF);
+		*out_ptr++ = (uint8_t)(offset >> 8U);
+		*token |= (uint8_t)min_uint32(match_len - LZ_MIN_MATCH, LZ_RUN_MASK);
+		if (match_len - LZ_MIN_MATCH >= LZ_RUN_MASK)
+		{
+			out_ptr = lz_write_run(out_ptr, match_len - LZ_MIN_MATCH - LZ_RUN_MASK);
+		}
+	}
+	return out_ptr;
+}
+
+/* ======================================================================= */
+/* Compress functions                                                      */
+/* ======================================================================= */
+
+static uint_fast32_t lz_compress(lz_enc_t *const ctx, const uint8_t *const message_in, const uint_fast32_t message_size)
+{
+	//Append message to history (not committed yet)
+	lz_rebase_hash(ctx->hash_table, lz_history_reserve(&ctx->history, message_size));
+	uint8_t *const base = ctx->history.buffer;
+	const uint_fast32_t begin = ctx->history.length, end = begin + message_size;
+	memcpy(base + begin, message_in, message_size);
+
+	//Find matches (greedy)
+	uint8_t *out_ptr = ctx->buffer;
+	uint_fast32_t pos = begin, anchor = begin;
+	if (message_size > LZ_MIN_MATCH)
+	{
+		const uint_fast32_t limit = end - LZ_MIN_MATCH;
+		while (pos <= limit)
+		{
+			const uint32_t hash = lz_hash(base + pos);
+			const uint_fast32_t candidate = ctx->hash_table[hash];
+			ctx->hash_table[hash] = (uint32_t)(pos + 1U);
+			if (candidate && (candidate - 1U < pos) && (pos - (candidate - 1U) <= LZ_WINDOW) && (!memcmp(base + candidate - 1U, base + pos, LZ_MIN_MATCH)))
+			{
+				const uint_fast32_t match_pos = candidate - 1U;
+				uint_fast32_t match_len = LZ_MIN_MATCH;
+				while ((pos + match_len < end) && (base[match_pos + match_len] == base[pos + match_len]))
+				{
+					++match_len;
+				}
+				out_ptr = lz_write_token(out_ptr, base + anchor, pos - anchor, pos - match_pos, match_len);
+				for (uint_fast32_t next = pos + 1U; (next < pos + match_len) && (next <= limit) && (ctx->effort < LZ_SPARSE_EFFORT); ++next)
+				{
+					ctx->hash_table[lz_hash(base + next)] = (uint32_t)(next + 1U);
+				}
+				anchor = (pos += match_len);
+			}
+			else
+			{
+				++pos;
+			}
+		}
+	}
+
+	//Write final literals
+	out_ptr = lz_write_token(out_ptr, base + anchor, end - anchor, 0U, 0U);
+	return (uint_fast32_t)(out_ptr - ctx->buffer);
+}
+
+static bool lz_enc_init(void **const state, const uint_fast32_t max_chunk_size)
+{
+	//Alloc context
+	lz_enc_t *const ctx = (lz_enc_t*)calloc(1U, sizeof(lz_enc_t));
+	if (!(*state = ctx))
+	{
+		return false;
+	}
+
+	//Alloc buffers
+	ctx->buffer_size = (ctx->max_chunk_size = max_chunk_size) + (max_chunk_size / 255U) + 16U;
+	if (!(lz_history_init(&ctx->history, max_chunk_size) && (ctx->buffer = (uint8_t*)malloc(ctx->buffer_size * sizeof(uint8_t)))))
+	{
+		free(ctx->history.buffer);
+		free(ctx);
+		*state = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+static bool lz_enc_reset(void *const state)
+{
+	lz_enc_t *const ctx = (lz_enc_t*)state;
+
+	//Stale hash table entries are harmless, as each candidate gets verified against the current history
+	ctx->history.length = 0U;
+	ctx->cache.message_in = NULL;
+	return true;
+}
+
+static bool lz_enc_effort(void *const state, const uint_fast32_t effort)
+{
+	lz_enc_t *const ctx = (lz_enc_t*)state;
+	ctx->effort = effort;
+	ctx->cache.message_in = NULL;
+	return true;
+}
+
+static bool lz_enc_load(void *const state, const uint8_t *const dict_in, const uint_fast32_t dict_size)
+{
+	lz_enc_t *const ctx = (lz_enc_t*)state;
+	const uint_fast32_t load_size = min_uint32(dict_size, LZ_WINDOW);
+
+	//Append dictionary to history
+	lz_rebase_hash(ctx->hash_table, lz_history_reserve(&ctx->history, load_size));
+	const uint_fast32_t begin = ctx->history.length;
+	memcpy(ctx->history.buffer + begin, dict_in + (dict_size - load_size), load_size);
+	ctx->history.length += load_size;
+
+	//Update hash table
+	for (uint_fast32_t pos = begin; pos + LZ_MIN_MATCH <= ctx->history.length; ++pos)
+	{
+		ctx->hash_table[lz_hash(ctx->history.buffer + pos)] = (uint32_t)(pos + 1U);
+	}
+
+	ctx->cache.message_in = NULL;
+	return true;
+}
+
+static uint_fast32_t lz_enc_test(void *const state, const uint8_t *const message_in, const uint_fast32_t message_size)
+{
+	lz_enc_t *const ctx = (lz_enc_t*)state;
+
+	//Check parameters
+	if (message_size > ctx->max_chunk_size)
+	{
+		return UINT_FAST32_MAX;
+	}
+
+	//Compress, but do *not* commit to history
+	ctx->cache.compressed_size = lz_compress(ctx, message_in, message_size);
+	ctx->cache.message_in = message_in;
+	ctx->cache.message_size = message_size;
+
+	return ctx->cache.compressed_size;
+}
+
+static const uint8_t *lz_enc_next(void *const state, const uint8_t *const message_in, const uint_fast32_t message_size, uint_fast32_t *const compressed_size)
+{
+	lz_enc_t *const ctx = (lz_enc_t*)state;
+
+	//Check parameters
+	if (message_size > ctx->max_chunk_size)
+	{
+		*compressed_size = 0U;
+		return NULL;
+	}
+
+	//Re-use result of previous test, if possible
+	if ((ctx->cache.message_in == message_in) && (ctx->cache.message_size == message_size))
+	{
+		*compressed_size = ctx->cache.compressed_size;
+	}
+	else
+	{
+		*compressed_size = lz_compress(ctx, message_in, message_size);
+	}
+
+	//Commit to history
+	ctx->history.length += message_size;
+	ctx->cache.message_in = NULL;
+	return ctx->buffer;
+}
+
+static bool lz_enc_free(void *const state)
+{
+	lz_enc_t *const ctx = (lz_enc_t*)state;
+	free(ctx->history.buffer);
+	free(ctx->buffer);
+	free(ctx);
+	return true;
+}
+
+static uint64_t lz_enc_memory(const uint_fast32_t max_chunk_size)
+{
+	return sizeof(lz_enc_t) + (2U * LZ_WINDOW) + max_chunk_size + max_chunk_size + (max_chunk_size / 255U) + 16U + LZ_OVERHEAD;
+}
+
+/* ======================================================================= */
+/* Decompress functions                                                    */
+/* ======================================================================= */
+
+static bool lz_dec_init(void **const state, const uint_fast32_t max_chunk_size)
+{
+	//Alloc context
+	lz_dec_t *const ctx = (lz_dec_t*)calloc(1U, sizeof(lz_dec_t));
+	if (!(*state = ctx))
+	{
+		return false;
+	}
+
+	//Alloc history
+	if (!lz_history_init(&ctx->history, ctx->max_chunk_size = max_chunk_size))
+	{
+		free(ctx);
+		*state = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+static bool lz_dec_reset(void *const state)
+{
+	lz_dec_t *const ctx = (lz_dec_t*)state;
+	ctx->history.length = 0U;
+	return true;
+}
+
+static bool lz_dec_load(void *const state, const uint8_t *const dict_in, const uint_fast32_t dict_size)
+{
+	lz_dec_t *const ctx = (lz_dec_t*)state;
+	const uint_fast32_t load_size = min_uint32(dict_size, LZ_WINDOW);
+
+	//Append dictionary to history
+	lz_history_reserve(&ctx->history, load_size);
+	memcpy(ctx->history.buffer + ctx->history.length, dict_in + (dict_size - load_size), load_size);
+	ctx->history.length += load_size;
+
+	return true;
+}
+
+static bool lz_dec_next(void *const state, const uint8_t *const compressed_in, const uint_fast32_t compressed_size, uint8_t *const message_out, const uint_fast32_t capacity, uint_fast32_t *const message_size)
+{
+	lz_dec_t *const ctx = (lz_dec_t*)state;
+	*message_size = 0U;
+
+	//Make room in history
+	lz_history_reserve(&ctx->history, ctx->max_chunk_size);
+	uint8_t *const base = ctx->history.buffer;
+	const uint_fast32_t begin = ctx->history.length, limit = begin + min_uint32(capacity, ctx->max_chunk_size);
+
+	//Decode tokens
+	uint_fast32_t in_pos = 0U, out_pos = begin;
+	while (in_pos < compressed_size)
+	{
+		const uint8_t token = compressed_in[in_pos++];
+		uint_fast32_t literal_len = token >> 4U;
+		if ((literal_len == LZ_RUN_MASK) && (!lz_read_run(&literal_len, compressed_in, &in_pos, compressed_size)))
+		{
+			return false;
+		}
+		if ((literal_len > compressed_size - in_pos) || (literal_len > limit - out_pos))
+		{
+			return false;
+		}
+		memcpy(base + out_pos, compressed_in + in_pos, literal_len);
+		in_pos += literal_len;
+		out_pos += literal_len;
+		if (in_pos >= compressed_size)
+		{
+			break; /*final literals*/
+		}
+		if (compressed_size - in_pos < 2U)
+		{
+			return false;
+		}
+		const uint_fast32_t offset = compressed_in[in_pos] | (compressed_in[in_pos + 1U] << 8U);
+		in_pos += 2U;
+		uint_fast32_t match_len = token & LZ_RUN_MASK;
+		if ((match_len == LZ_RUN_MASK) && (!lz_read_run(&match_len, compressed_in, &in_pos, compressed_size)))
+		{
+			return false;
+		}
+		if ((!offset) || (offset > out_pos) || ((match_len += LZ_MIN_MATCH) > limit - out_pos))
+		{
+			return false;
+		}
+		for (const uint8_t *match_ptr = base + out_pos - offset; match_len; --match_len)
+		{
+			base[out_pos++] = *match_ptr++;
+		}
+	}
+
+	//Commit to history
+	memcpy(message_out, base + begin, *message_size = out_pos - begin);
+	ctx->history.length = out_pos;
+	return true;
+}
+
+static bool lz_dec_free(void *const state)
+{
+	lz_dec_t *const ctx = (lz_dec_t*)state;
+	free(ctx->history.buffer);
+	free(ctx);
+	return true;
+}
+
+/* ======================================================================= */
+/* Backend                                                                 */
+/* ======================================================================= */
+
+const codec_vtbl_t MPATCH_CODEC_LZ =
+{
+	"LZ77",
+	lz_enc_init, lz_enc_reset, lz_enc_effort, lz_enc_load, lz_enc_test, lz_enc_next, lz_enc_free, lz_enc_memory,
+	lz_dec_init, lz_dec_reset, lz_dec_load, lz_dec_next, lz_dec_free
+};
\ No newline at end of file
@@ -0,0 +1,324 @@
+/* ---------------------------------------------------------------------------------------------- */
+/* MPatchLib - simple patch and compression library                                               */
+/* Copyright(c) 2018 LoRd_MuldeR <mulder2@gmx.de>                                                 */
+/*                                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy of this software  */
+/* and associated documentation files (the "Software"), to deal in the Software without           */
+/* restriction, including without limitation the rights to use, copy, modify, merge, publish,     */
+/* distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the  */
+/* Software is furnished to do so, subject to the following conditions:                           */
+/*                                                                                                */
+/* The above copyright notice and this permission notice shall be included in all copies or       */
+/* substantial portions of the Software.                                                          */
+/*                                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING  */
+/* BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND     */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,   */
+/* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.        */
+/* ---------------------------------------------------------------------------------------------- */
+
+#include "compress.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <malloc.h>
+#include <memory.h>
+
+#include <zlib.h>
+
+typedef struct
+{
+	z_stream stream;
+	uint_fast32_t max_chunk_size, buffer_size;
+	uint8_t *buffer;
+	int level;
+}
+zlib_enc_t;
+
+static const int ZLIB_LEVEL[COMPRESS_EFFORT_MAX + 1U] = { 9, 6, 3, 1 };
+static const uint64_t DEFLATE_OVERHEAD = 16384U; /*internal state (private to zlib) and the page rounding of its larger buffers*/
+
+typedef struct
+{
+	z_stream stream;
+	uint_fast32_t max_chunk_size;
+}
+zlib_dec_t;
+
+/* ======================================================================= */
+/* Compress functions                                                      */
+/* ======================================================================= */
+
+static bool zlib_enc_init(void **const state, const uint_fast32_t max_chunk_size)
+{
+	//Alloc context
+	zlib_enc_t *const ctx = (zlib_enc_t*)calloc(1U, sizeof(zlib_enc_t));
+	if (!(*state = ctx))
+	{
+		return false;
+	}
+
+	//Create deflate stream
+	ctx->level = ZLIB_LEVEL[0U];
+	if (deflateInit2(&ctx->stream, ctx->level, Z_DEFLATED, -15, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		free(ctx);
+		*state = NULL;
+		return false;
+	}
+
+	//Alloc buffer
+	ctx->buffer_size = deflateBound(&ctx->stream, (ctx->max_chunk_size = max_chunk_size) + 1U);
+	if (!(ctx->buffer = (uint8_t*)calloc(ctx->buffer_size, sizeof(uint8_t))))
+	{
+		deflateEnd(&ctx->stream);
+		free(ctx);
+		*state = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+static bool zlib_enc_reset(void *const state)
+{
+	zlib_enc_t *const ctx = (zlib_enc_t*)state;
+	return (deflateReset(&ctx->stream) == Z_OK);
+}
+
+static bool zlib_enc_effort(void *const state, const uint_fast32_t effort)
+{
+	zlib_enc_t *const ctx = (zlib_enc_t*)state;
+	const int level = ZLIB_LEVEL[effort];
+	if (level == ctx->level)
+	{
+		return true;
+	}
+
+	//Re-create the deflate stream, as deflateParams() may emit a block when switching between "fast" and "slow" levels
+	deflateEnd(&ctx->stream);
+	if (deflateInit2(&ctx->stream, level, Z_DEFLATED, -15, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		ctx->level = -1;
+		return false;
+	}
+
+	ctx->level = level;
+	return true;
+}
+
+static bool zlib_enc_load(void *const state, const uint8_t *const dict_in, const uint_fast32_t dict_size)
+{
+	zlib_enc_t *const ctx = (zlib_enc_t*)state;
+
+	//Pre-load dictionary (raw deflate permits this after each flushed block)
+	if (deflateSetDictionary(&ctx->stream, dict_in, min_uint32(32768U, dict_size)) != Z_OK)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+static uint_fast32_t zlib_enc_test(void *const state, const uint8_t *const message_in, const uint_fast32_t message_size)
+{
+	zlib_enc_t *const ctx = (zlib_enc_t*)state;
+
+	//Check parameters
+	if ((!ctx->buffer) || (message_size > ctx->max_chunk_size))
+	{
+		return UINT_FAST32_MAX;
+	}
+
+	//Copy the deflate stream
+	z_stream temp;
+	if (deflateCopy(&temp, &ctx->stream) != Z_OK)
+	{
+		return UINT_FAST32_MAX;
+	}
+
+	//Setup temporary deflate stream
+	temp.next_in = (Bytef*)message_in;
+	temp.next_out = ctx->buffer;
+	temp.avail_in = message_size;
+	temp.avail_out = ctx->buffer_size;
+
+	//Try to compress
+	if (deflate(&temp, Z_SYNC_FLUSH) != Z_OK)
+	{
+		deflateEnd(&temp);
+		return UINT_FAST32_MAX;
+	}
+
+	//Sanity check
+	if (temp.avail_out < 1U)
+	{
+		abort();
+	}
+
+	//Compute compressed size
+	const uint_fast32_t compressed_size = ctx->buffer_size - temp.avail_out;
+
+	//Free temporary stream
+	const int error = deflateEnd(&temp);
+	if ((error != Z_OK) && (error != Z_DATA_ERROR))
+	{
+		return UINT_FAST32_MAX;
+	}
+
+	return compressed_size;
+}
+
+static const uint8_t *zlib_enc_next(void *const state, const uint8_t *const message_in, const uint_fast32_t message_size, uint_fast32_t *const compressed_size)
+{
+	zlib_enc_t *const ctx = (zlib_enc_t*)state;
+
+	//Check parameters
+	if ((!ctx->buffer) || (message_size > ctx->max_chunk_size))
+	{
+		*compressed_size = 0U;
+		return NULL;
+	}
+
+	//Setup deflate stream
+	ctx->stream.next_in = (Bytef*)message_in;
+	ctx->stream.next_out = ctx->buffer;
+	ctx->stream.avail_in = message_size;
+	ctx->stream.avail_out = ctx->buffer_size;
+
+	//Try to compress
+	if (deflate(&ctx->stream, Z_SYNC_FLUSH) != Z_OK)
+	{
+		return NULL;
+	}
+
+	//Sanity check
+	if (ctx->stream.avail_out < 1U)
+	{
+		abort();
+	}
+
+	//Compute compressed size
+	*compressed_size = ctx->buffer_size - ctx->stream.avail_out;
+	return ctx->buffer;
+}
+
+static bool zlib_enc_free(void *const state)
+{
+	zlib_enc_t *const ctx = (zlib_enc_t*)state;
+
+	//Destroy deflate context
+	const int error = deflateEnd(&ctx->stream);
+
+	//Free buffer
+	if (ctx->buffer)
+	{
+		free(ctx->buffer);
+	}
+
+	//Free context
+	free(ctx);
+
+	//Check result
+	return ((error == Z_OK) || (error == Z_DATA_ERROR));
+}
+
+static uint64_t zlib_enc_memory(const uint_fast32_t max_chunk_size)
+{
+	//Deflate needs "(1 << (windowBits + 2)) + (1 << (memLevel + 9))" bytes, according to the zlib documentation, plus some
+	//overhead; zlib_enc_test() holds a copy of the stream while it runs, so there are two of them
+	return sizeof(zlib_enc_t) + (2U * ((1U << 17U) + (1U << 18U) + DEFLATE_OVERHEAD)) + compressBound(max_chunk_size + 1U);
+}
+
+/* ======================================================================= */
+/* Decompress functions                                                    */
+/* ======================================================================= */
+
+static bool zlib_dec_init(void **const state, const uint_fast32_t max_chunk_size)
+{
+	//Alloc context
+	zlib_dec_t *const ctx = (zlib_dec_t*)calloc(1U, sizeof(zlib_dec_t));
+	if (!(*state = ctx))
+	{
+		return false;
+	}
+
+	//Create inflate stream
+	if (inflateInit2(&ctx->stream, -15) != Z_OK)
+	{
+		free(ctx);
+		*state = NULL;
+		return false;
+	}
+
+	ctx->max_chunk_size = max_chunk_size;
+	return true;
+}
+
+static bool zlib_dec_reset(void *const state)
+{
+	zlib_dec_t *const ctx = (zlib_dec_t*)state;
+	return (inflateReset(&ctx->stream) == Z_OK);
+}
+
+static bool zlib_dec_load(void *const state, const uint8_t *const dict_in, const uint_fast32_t dict_size)
+{
+	zlib_dec_t *const ctx = (zlib_dec_t*)state;
+
+	//Pre-load dictionary (raw inflate permits this at any time)
+	if (inflateSetDictionary(&ctx->stream, dict_in, min_uint32(32768U, dict_size)) != Z_OK)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+static bool zlib_dec_next(void *const state, const uint8_t *const compressed_in, const uint_fast32_t compressed_size, uint8_t *const message_out, const uint_fast32_t capacity, uint_fast32_t *const message_size)
+{
+	zlib_dec_t *const ctx = (zlib_dec_t*)state;
+	*message_size = 0U;
+
+	//Setup inflate stream
+	ctx->stream.next_in = (Bytef*)compressed_in;
+	ctx->stream.next_out = message_out;
+	ctx->stream.avail_in = compressed_size;
+	ctx->stream.avail_out = min_uint32(capacity, ctx->max_chunk_size);
+
+	//Try to decompress
+	const int error = inflate(&ctx->stream, Z_SYNC_FLUSH);
+	if (((error != Z_OK) && (error != Z_BUF_ERROR)) || ctx->stream.avail_in)
+	{
+		return false;
+	}
+
+	//Compute decompressed size
+	*message_size = min_uint32(capacity, ctx->max_chunk_size) - ctx->stream.avail_out;
+	return true;
+}
+
+static bool zlib_dec_free(void *const state)
+{
+	zlib_dec_t *const ctx = (zlib_dec_t*)state;
+
+	//Destroy inflate context
+	const int error = inflateEnd(&ctx->stream);
+
+	//Free context
+	free(ctx);
+
+	//Check result
+	return (error == Z_OK);
+}
+
+/* ======================================================================= */
+/* Backend                                                                 */
+/* ======================================================================= */
+
+const codec_vtbl_t MPATCH_CODEC_ZLIB =
+{
+	"Deflate",
+	zlib_enc_init, zlib_enc_reset, zlib_enc_effort, zlib_enc_load, zlib_enc_test, zlib_enc_next, zlib_enc_free, zlib_enc_memory,
+	zlib_dec_init, zlib_dec_reset, zlib_dec_load, zlib_dec_next, zlib_dec_free
+};
\ No newline at end of file
@@ -29,16 +29,30 @@
 
 struct _mpatch_cctx_t
 {
-	z_stream stream;
-	uint_fast32_t max_chunk_size, buffer_size;
-	uint8_t *buffer;
+	const codec_vtbl_t *codec;
+	void *state;
 };
 
+struct _mpatch_dctx_t
+{
+	const codec_vtbl_t *codec;
+	void *state;
+};
+
+static const codec_vtbl_t *const CODECS[] =
+{
+	&MPATCH_CODEC_ZLIB,
+	&MPATCH_CODEC_LZ,
+	NULL
+};
+
+#define CODEC_COUNT ((sizeof(CODECS) / sizeof(CODECS[0])) - 1U)
+
 /* ======================================================================= */
 /* Compress functions                                                      */
 /* ======================================================================= */
 
-bool mpatch_compress_enc_init(mpatch_cctx_t **const cctx, const uint_fast32_t max_chunk_size)
+bool mpatch_compress_enc_init(mpatch_cctx_t **const cctx, const uint_fast32_t codec_id, const uint_fast32_t max_chunk_size)
 {
 	//Check output pointer
 	if (!cctx)
@@ -47,7 +61,7 @@ bool mpatch_compress_enc_init(mpatch_cctx_t **const cctx, const uint_fast32_t ma
 	}
 
 	//Check parameter
-	if (max_chunk_size < 1U)
+	if ((codec_id >= CODEC_COUNT) || (max_chunk_size < 1U))
 	{
 		*cctx = NULL;
 		return false;
@@ -59,25 +73,38 @@ bool mpatch_compress_enc_init(mpatch_cctx_t **const cctx, const uint_fast32_t ma
 		return false;
 	}
 
-	//Create deflate stream
-	if (deflateInit2(&(*cctx)->stream, 9, Z_DEFLATED, -15, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+	//Create backend state
+	(*cctx)->codec = CODECS[codec_id];
+	if (!(*cctx)->codec->enc_init(&(*cctx)->state, max_chunk_size))
 	{
 		free(*cctx);
 		*cctx = NULL;
 		return false;
 	}
 
-	//Alloc buffer
-	(*cctx)->buffer_size = deflateBound(&(*cctx)->stream, ((*cctx)->max_chunk_size = max_chunk_size) + 1U);
-	if (!((*cctx)->buffer = (uint8_t*)calloc((*cctx)->buffer_size, sizeof(uint8_t))))
+	return true;
+}
+
+bool mpatch_compress_enc_reset(mpatch_cctx_t *const cctx)
+{
+	//Check parameters
+	if (!cctx)
+	{
+		return false;
+	}
+
+	return cctx->codec->enc_reset(cctx->state);
+}
+
+bool mpatch_compress_enc_effort(mpatch_cctx_t *const cctx, const uint_fast32_t effort)
+{
+	//Check parameters
+	if ((!cctx) || (effort > COMPRESS_EFFORT_MAX))
 	{
-		deflateEnd(&(*cctx)->stream);
-		free(*cctx);
-		*cctx = NULL;
 		return false;
 	}
 
-	return true;
+	return cctx->codec->enc_effort(cctx->state, effort);
 }
 
 bool mpatch_compress_enc_load(mpatch_cctx_t *const cctx, const uint8_t *const dict_in, const uint_fast32_t dict_size)
@@ -88,124 +115,160 @@ bool mpatch_compress_enc_load(mpatch_cctx_t *const cctx, const uint8_t *const di
 		return false;
 	}
 
-	//Pre-load dictionary
-	if (deflateSetDictionary(&cctx->stream, dict_in, min_uint32(32768U, dict_size)) != Z_OK)
+	return cctx->codec->enc_load(cctx->state, dict_in, dict_size);
+}
+
+uint_fast32_t mpatch_compress_enc_test(mpatch_cctx_t *const cctx, const uint8_t *const message_in, const uint_fast32_t message_size)
+{
+	//Check parameters
+	if ((!cctx) || (!message_in))
 	{
 		return UINT_FAST32_MAX;
 	}
 
-	return true;
+	return cctx->codec->enc_test(cctx->state, message_in, message_size);
 }
 
-uint_fast32_t mpatch_compress_enc_test(mpatch_cctx_t *const cctx, const uint8_t *const message_in, const uint_fast32_t message_size)
+const uint8_t *mpatch_compress_enc_next(mpatch_cctx_t *const cctx, const uint8_t *const message_in, const uint_fast32_t message_size, uint_fast32_t *const compressed_size)
 {
 	//Check parameters
-	if ((!cctx) || (!cctx->buffer) || (!message_in) || (message_size > cctx->max_chunk_size))
+	if ((!cctx) || (!message_in))
 	{
-		return UINT_FAST32_MAX;
+		*compressed_size = 0U;
+		return NULL;
 	}
 
-	//Copy the deflate stream
-	z_stream temp;
-	if (deflateCopy(&temp, &cctx->stream) != Z_OK)
+	return cctx->codec->enc_next(cctx->state, message_in, message_size, compressed_size);
+}
+
+bool mpatch_compress_enc_free(mpatch_cctx_t **const cctx)
+{
+	//Check parameters
+	if ((!cctx) || (!(*cctx)))
 	{
-		return UINT_FAST32_MAX;
+		return false;
 	}
 
-	//Setup temporary deflate stream
-	temp.next_in = message_in;
-	temp.next_out = cctx->buffer;
-	temp.avail_in = message_size;
-	temp.avail_out = cctx->buffer_size;
+	//Destroy backend state
+	const bool success = (*cctx)->codec->enc_free((*cctx)->state);
+
+	//Free context
+	free(*cctx);
+	*cctx = NULL;
 
-	//Try to compress
-	if (deflate(&temp, Z_SYNC_FLUSH) != Z_OK)
+	return success;
+}
+
+uint64_t mpatch_compress_enc_memory(const uint_fast32_t codec_id, const uint_fast32_t max_chunk_size)
+{
+	//Check parameter
+	if (codec_id >= CODEC_COUNT)
 	{
-		deflateEnd(&temp);
-		return UINT_FAST32_MAX;
+		return 0U;
+	}
+
+	return sizeof(mpatch_cctx_t) + CODECS[codec_id]->enc_memory(max_chunk_size);
+}
+
+/* ======================================================================= */
+/* Decompress functions                                                    */
+/* ======================================================================= */
+
+bool mpatch_compress_dec_init(mpatch_dctx_t **const dctx, const uint_fast32_t codec_id, const uint_fast32_t max_chunk_size)
+{
+	//Check output pointer
+	if (!dctx)
+	{
+		return false;
 	}
 
-	//Sanity check
-	if (temp.avail_out < 1U)
+	//Check parameter
+	if ((codec_id >= CODEC_COUNT) || (max_chunk_size < 1U))
 	{
-		abort();
+		*dctx = NULL;
+		return false;
 	}
 
-	//Compute compressed size
-	const uint_fast32_t compressed_size = cctx->buffer_size - temp.avail_out;
+	//Alloc context
+	if (!(*dctx = (mpatch_dctx_t*)calloc(1U, sizeof(mpatch_dctx_t))))
+	{
+		return false;
+	}
 
-	//Free temporary stream
-	const int error = deflateEnd(&temp);
-	if ((error != Z_OK) && (error != Z_DATA_ERROR))
+	//Create backend state
+	(*dctx)->codec = CODECS[codec_id];
+	if (!(*dctx)->codec->dec_init(&(*dctx)->state, max_chunk_size))
 	{
-		return UINT_FAST32_MAX;;
+		free(*dctx);
+		*dctx = NULL;
+		return false;
 	}
 
-	return compressed_size;
+	return true;
 }
 
-const uint8_t *mpatch_compress_enc_next(mpatch_cctx_t *const cctx, const uint8_t *const message_in, const uint_fast32_t message_size, uint_fast32_t *const compressed_size)
+bool mpatch_compress_dec_reset(mpatch_dctx_t *const dctx)
 {
 	//Check parameters
-	if ((!cctx) || (!cctx->buffer) || (!message_in) || (message_size > cctx->max_chunk_size))
+	if (!dctx)
 	{
-		*compressed_size = 0U;
-		return NULL;
+		return false;
 	}
 
-	//Setup deflate stream
-	cctx->stream.next_in = message_in;
-	cctx->stream.next_out = cctx->buffer;
-	cctx->stream.avail_in = message_size;
-	cctx->stream.avail_out = cctx->buffer_size;
-
-	//Try to compress
-	if (deflate(&cctx->stream, Z_SYNC_FLUSH) != Z_OK)
-	{
-		return NULL;
-	}
+	return dctx->codec->dec_reset(dctx->state);
+}
 
-	//Sanity check
-	if (cctx->stream.avail_out < 1U)
+bool mpatch_compress_dec_load(mpatch_dctx_t *const dctx, const uint8_t *const dict_in, const uint_fast32_t dict_size)
+{
+	//Check parameters
+	if ((!dctx) || (!dict_in) || (dict_size < 1U))
 	{
-		abort();
+		return false;
 	}
 
-	//Compute compressed size
-	*compressed_size = cctx->buffer_size - cctx->stream.avail_out;
-	return cctx->buffer;
+	return dctx->codec->dec_load(dctx->state, dict_in, dict_size);
 }
 
-bool mpatch_compress_enc_free(mpatch_cctx_t **const cctx)
+bool mpatch_compress_dec_next(mpatch_dctx_t *const dctx, const uint8_t *const compressed_in, const uint_fast32_t compressed_size, uint8_t *const message_out, const uint_fast32_t capacity, uint_fast32_t *const message_size)
 {
 	//Check parameters
-	if ((!cctx) || (!(*cctx)))
+	if ((!dctx) || (!compressed_in) || (!message_out))
 	{
+		*message_size = 0U;
 		return false;
 	}
 
-	//Destroy deflate context
-	const int error = deflateEnd(&(*cctx)->stream);
+	return dctx->codec->dec_next(dctx->state, compressed_in, compressed_size, message_out, capacity, message_size);
+}
 
-	//Free buffer
-	if ((*cctx)->buffer)
+bool mpatch_compress_dec_free(mpatch_dctx_t **const dctx)
+{
+	//Check parameters
+	if ((!dctx) || (!(*dctx)))
 	{
-		free((*cctx)->buffer);
+		return false;
 	}
 
+	//Destroy backend state
+	const bool success = (*dctx)->codec->dec_free((*dctx)->state);
+
 	//Free context
-	free(*cctx);
-	*cctx = NULL;
+	free(*dctx);
+	*dctx = NULL;
 
-	//Check result
-	return ((error == Z_OK) || (error == Z_DATA_ERROR));
+	return success;
 }
 
 /* ======================================================================= */
-/* Compress functions                                                      */
+/* Utility functions                                                       */
 /* ======================================================================= */
 
 const char *mpatch_compress_libver(void)
 {
 	return zlibVersion();
 }
+
+const char *mpatch_compress_codec_name(const uint_fast32_t codec_id)
+{
+	return (codec_id < CODEC_COUNT) ? CODECS[codec_id]->name : NULL;
+}
\ No newline at end of file
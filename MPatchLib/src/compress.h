@@ -24,16 +24,54 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#define COMPRESS_EFFORT_MAX 3U /*effort "0" gives the best compression, COMPRESS_EFFORT_MAX is the fastest*/
+
 typedef struct _mpatch_cctx_t mpatch_cctx_t;
+typedef struct _mpatch_dctx_t mpatch_dctx_t;
+
+//Backend interface
+typedef struct
+{
+	const char *name;
+	bool (*enc_init)(void **const state, const uint_fast32_t max_chunk_size);
+	bool (*enc_reset)(void *const state);
+	bool (*enc_effort)(void *const state, const uint_fast32_t effort);
+	bool (*enc_load)(void *const state, const uint8_t *const dict_in, const uint_fast32_t dict_size);
+	uint_fast32_t (*enc_test)(void *const state, const uint8_t *const message_in, const uint_fast32_t message_size);
+	const uint8_t *(*enc_next)(void *const state, const uint8_t *const message_in, const uint_fast32_t message_size, uint_fast32_t *const compressed_size);
+	bool (*enc_free)(void *const state);
+	uint64_t (*enc_memory)(const uint_fast32_t max_chunk_size);
+	bool (*dec_init)(void **const state, const uint_fast32_t max_chunk_size);
+	bool (*dec_reset)(void *const state);
+	bool (*dec_load)(void *const state, const uint8_t *const dict_in, const uint_fast32_t dict_size);
+	bool (*dec_next)(void *const state, const uint8_t *const compressed_in, const uint_fast32_t compressed_size, uint8_t *const message_out, const uint_fast32_t capacity, uint_fast32_t *const message_size);
+	bool (*dec_free)(void *const state);
+}
+codec_vtbl_t;
+
+//Backends
+extern const codec_vtbl_t MPATCH_CODEC_ZLIB;
+extern const codec_vtbl_t MPATCH_CODEC_LZ;
 
 //Compress
-bool mpatch_compress_enc_init(mpatch_cctx_t **const cctx, const uint_fast32_t max_chunk_size);
+bool mpatch_compress_enc_init(mpatch_cctx_t **const cctx, const uint_fast32_t codec_id, const uint_fast32_t max_chunk_size);
+bool mpatch_compress_enc_reset(mpatch_cctx_t *const cctx);
+bool mpatch_compress_enc_effort(mpatch_cctx_t *const cctx, const uint_fast32_t effort); /*call right after a reset*/
 bool mpatch_compress_enc_load(mpatch_cctx_t *const cctx, const uint8_t *const dict_in, const uint_fast32_t dict_size);
 uint_fast32_t mpatch_compress_enc_test(mpatch_cctx_t *const cctx, const uint8_t *const message_in, const uint_fast32_t message_size);
 const uint8_t *mpatch_compress_enc_next(mpatch_cctx_t *const cctx, const uint8_t *const message_in, const uint_fast32_t message_size, uint_fast32_t *const compressed_size);
 bool mpatch_compress_enc_free(mpatch_cctx_t **const cctx);
+uint64_t mpatch_compress_enc_memory(const uint_fast32_t codec_id, const uint_fast32_t max_chunk_size); /*estimated size of an encoder context*/
+
+//Decompress
+bool mpatch_compress_dec_init(mpatch_dctx_t **const dctx, const uint_fast32_t codec_id, const uint_fast32_t max_chunk_size);
+bool mpatch_compress_dec_reset(mpatch_dctx_t *const dctx);
+bool mpatch_compress_dec_load(mpatch_dctx_t *const dctx, const uint8_t *const dict_in, const uint_fast32_t dict_size);
+bool mpatch_compress_dec_next(mpatch_dctx_t *const dctx, const uint8_t *const compressed_in, const uint_fast32_t compressed_size, uint8_t *const message_out, const uint_fast32_t capacity, uint_fast32_t *const message_size);
+bool mpatch_compress_dec_free(mpatch_dctx_t **const dctx);
 
 //Utils
 const char *mpatch_compress_libver(void);
+const char *mpatch_compress_codec_name(const uint_fast32_t codec_id);
 
 #endif /*_INC_MPATCH_COMPRESS*/
\ No newline at end of file
@@ -0,0 +1,565 @@
+/* ---------------------------------------------------------------------------------------------- */
+/* MPatchLib - patch and compression library                                                      */
+/* Copyright(c) 2018 LoRd_MuldeR <mulder2@gmx.de>                                                 */
+/*                                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy of this software  */
+/* and associated documentation files (the "Software"), to deal in the Software without           */
+/* restriction, including without limitation the rights to use, copy, modify, merge, publish,     */
+/* distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the  */
+/* Software is furnished to do so, subject to the following conditions:                           */
+/*                                                                                                */
+/* The above copyright notice and this permission notice shall be included in all copies or       */
+/* substantial portions of the Software.                                                          */
+/*                                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING  */
+/* BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND     */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,   */
+/* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.        */
+/* ---------------------------------------------------------------------------------------------- */
+
+
+#include "libmpatch.h"
+#include "utils.h"
+#include "bit_io.h"
+#include "substring.h"
+#include "compress.h"
+#include "dictionary.h"
+#include "segment.h"
+
+#include <stdlib.h>
+
+#define OUTPUT_WINDOW ((2U * LITERAL_BLOCK) + DICT_TAIL)
+#define COMMIT_SIZE 16384U
+
+/*
+ * Output is collected in a window. If the caller provides a buffer for the entire message, then that buffer is the
+ * window. Otherwise, an internal window of OUTPUT_WINDOW bytes is used and, whenever it runs full, its content is passed
+ * to the writer function, retaining the last DICT_TAIL bytes that may still be needed to prime the dictionary. The MD5
+ * checksum of the output is updated as the output is written. Reference data is either taken from a buffer or fetched
+ * via the accessor function, so peak memory usage is independent of the message size in "streaming" mode.
+ *
+ * In "in-place" mode, the reference buffer is also the output buffer. The internal window then is a staging area: its
+ * content is committed to the shared buffer (after it was passed to the journal function) once COMMIT_SIZE bytes have
+ * accumulated, but only at points where the dictionary of the current literal block has not been primed yet. At such a
+ * point, the decoder state can be restored from a checkpoint. Since in-place patches never read the reference before the
+ * current message position, committing the output never destroys reference data that is still needed.
+ */
+
+typedef struct
+{
+	io_state_t input_state;
+	mpatch_dctx_t *dctx;
+	uint64_t prev_offset;
+	uint64_t dict_offset;
+	uint64_t block_id;
+	uint64_t segment_start;
+	uint64_t segment_end;
+	mpatch_rd_buffer_t reference_buffer;
+	mpatch_accessor_t reference_accessor;
+	uint64_t reference_len;
+	mpatch_writer_t output_writer;
+	mpatch_journal_t journal;
+	uint8_t *in_place_buffer;
+	bool in_place;
+	const cancel_token_t *cancel;
+	uint64_t copy_offset;
+	uint64_t copy_length;
+	uint8_t *output_buffer;
+	uint64_t output_capacity;
+	uint64_t output_base;
+	uint64_t output_fill;
+	uint64_t output_flushed;
+	uint64_t output_len;
+	md5_ctx output_md5;
+	uint8_t literal_buffer[MAX_LITERAL_LEN];
+	uint8_t dict_buffer[DICT_SIZE];
+	uint8_t window_buffer[OUTPUT_WINDOW];
+}
+decd_state_t;
+
+/* ======================================================================= */
+/* Reference functions                                                     */
+/* ======================================================================= */
+
+static __forceinline bool _copy_reference(uint8_t *data, uint64_t offset, uint64_t len, decd_state_t *const coder_state)
+{
+	if (coder_state->reference_buffer.buffer)
+	{
+		memcpy(data, coder_state->reference_buffer.buffer + offset, (size_t)len);
+		return true;
+	}
+	while (len)
+	{
+		const uint32_t chunk_len = (uint32_t)min_uint64(len, UINT32_MAX); /*the accessor takes a 32-bit size*/
+		if (!coder_state->reference_accessor.accessor_func(data, offset, chunk_len, coder_state->reference_accessor.user_data))
+		{
+			return false;
+		}
+		data += chunk_len;
+		offset += chunk_len;
+		len -= chunk_len;
+	}
+	return true;
+}
+
+static inline const uint8_t *_reference_window(const uint64_t offset, const uint_fast32_t len, decd_state_t *const coder_state)
+{
+	if (coder_state->reference_buffer.buffer)
+	{
+		return coder_state->reference_buffer.buffer + offset;
+	}
+	return _copy_reference(coder_state->dict_buffer, offset, len, coder_state) ? coder_state->dict_buffer : NULL;
+}
+
+static bool digest_reference(uint8_t *const digest, decd_state_t *const coder_state)
+{
+	md5_ctx md5_ctx;
+	mpatch_md5_init(&md5_ctx);
+	if (coder_state->reference_buffer.buffer)
+	{
+		for (uint64_t offset = 0U, len; offset < coder_state->reference_len; offset += len)
+		{
+			if (is_cancelled(coder_state->cancel))
+			{
+				return false;
+			}
+			len = min_uint64(CANCEL_POLL_SIZE, coder_state->reference_len - offset);
+			mpatch_md5_update(&md5_ctx, coder_state->reference_buffer.buffer + offset, len);
+		}
+		mpatch_md5_final(&md5_ctx, digest);
+		return true;
+	}
+	for (uint64_t offset = 0U; offset < coder_state->reference_len; offset += DICT_SIZE)
+	{
+		const uint_fast32_t len = (uint_fast32_t)min_uint64(DICT_SIZE, coder_state->reference_len - offset);
+		if (is_cancelled(coder_state->cancel) || (!_copy_reference(coder_state->dict_buffer, offset, len, coder_state)))
+		{
+			return false;
+		}
+		mpatch_md5_update(&md5_ctx, coder_state->dict_buffer, len);
+	}
+	mpatch_md5_final(&md5_ctx, digest);
+	return true;
+}
+
+/* ======================================================================= */
+/* Output functions                                                        */
+/* ======================================================================= */
+
+static __forceinline uint64_t output_position(const decd_state_t *const coder_state)
+{
+	return coder_state->output_base + coder_state->output_fill;
+}
+
+static bool flush_output(decd_state_t *const coder_state)
+{
+	const uint64_t len = coder_state->output_fill - coder_state->output_flushed;
+	if (len)
+	{
+		const uint8_t *const data = coder_state->output_buffer + coder_state->output_flushed;
+		if (coder_state->output_writer.writer_func)
+		{
+			if (!coder_state->output_writer.writer_func(data, (uint32_t)len, coder_state->output_writer.user_data))
+			{
+				return false;
+			}
+		}
+		else if (coder_state->in_place_buffer)
+		{
+			if (coder_state->journal.journal_func)
+			{
+				const mpatch_checkpoint_t checkpoint = { input_bit_position(&coder_state->input_state), output_position(coder_state),
+					coder_state->prev_offset, coder_state->copy_offset, coder_state->copy_length };
+				if (!coder_state->journal.journal_func(data, (uint32_t)len, &checkpoint, coder_state->journal.user_data))
+				{
+					return false;
+				}
+			}
+			memcpy(coder_state->in_place_buffer + coder_state->output_base + coder_state->output_flushed, data, (size_t)len);
+		}
+		mpatch_md5_update(&coder_state->output_md5, data, (size_t)len);
+		coder_state->output_flushed = coder_state->output_fill;
+	}
+	return true;
+}
+
+static __forceinline bool _can_commit(const decd_state_t *const coder_state)
+{
+	return (coder_state->block_id != output_position(coder_state) / LITERAL_BLOCK);
+}
+
+static bool _reserve_output(const uint64_t len, decd_state_t *const coder_state)
+{
+	const bool commit = coder_state->in_place_buffer && (coder_state->output_fill - coder_state->output_flushed >= COMMIT_SIZE) && _can_commit(coder_state);
+	if (commit || (len > coder_state->output_capacity - coder_state->output_fill))
+	{
+		if (!((coder_state->output_writer.writer_func || (coder_state->in_place_buffer && _can_commit(coder_state))) && flush_output(coder_state)))
+		{
+			return false;
+		}
+		const uint_fast32_t keep_len = (uint_fast32_t)min_uint64(DICT_TAIL, coder_state->output_fill);
+		const uint64_t drop_len = coder_state->output_fill - keep_len;
+		memmove(coder_state->output_buffer, coder_state->output_buffer + drop_len, keep_len);
+		coder_state->output_base += drop_len;
+		coder_state->output_fill = coder_state->output_flushed = keep_len;
+	}
+	return true;
+}
+
+/* ======================================================================= */
+/* Dictionary functions                                                    */
+/* ======================================================================= */
+
+static bool _prepare_dictionary(decd_state_t *const coder_state)
+{
+	dict_window_t window;
+	const uint64_t output_pos = output_position(coder_state);
+	const uint64_t block_id = output_pos / LITERAL_BLOCK;
+	if (block_id != coder_state->block_id)
+	{
+		dict_prime_window(&window, output_pos, coder_state->segment_start, coder_state->prev_offset, coder_state->reference_len, coder_state->in_place);
+		const uint8_t *const reference_data = _reference_window(window.offset, window.length, coder_state);
+		if (!(reference_data && mpatch_compress_dec_reset(coder_state->dctx) && mpatch_compress_dec_load(coder_state->dctx, reference_data, window.length)))
+		{
+			return false;
+		}
+		if (window.tail_len)
+		{
+			if (!mpatch_compress_dec_load(coder_state->dctx, coder_state->output_buffer + (coder_state->output_fill - window.tail_len), window.tail_len))
+			{
+				return false;
+			}
+		}
+		coder_state->dict_offset = window.offset;
+		coder_state->block_id = block_id;
+	}
+	else if (dict_update_window(&window, output_pos, coder_state->dict_offset, coder_state->prev_offset, coder_state->reference_len, coder_state->in_place))
+	{
+		const uint8_t *const reference_data = _reference_window(window.offset, window.length, coder_state);
+		if (!(reference_data && mpatch_compress_dec_load(coder_state->dctx, reference_data, window.length)))
+		{
+			return false;
+		}
+		coder_state->dict_offset = window.offset;
+	}
+	return true;
+}
+
+/* ======================================================================= */
+/* Decoder functions                                                       */
+/* ======================================================================= */
+
+static void init_decd_state(decd_state_t *const coder_state, const mpatch_dec_param_t *const param)
+{
+	init_io_state(&coder_state->input_state);
+	coder_state->prev_offset = coder_state->dict_offset = 0U;
+	coder_state->block_id = UINT64_MAX;
+
+	//Set up reference
+	coder_state->reference_buffer = param->reference_in;
+	coder_state->reference_accessor = param->reference_acc;
+	coder_state->reference_len = param->reference_in.buffer ? param->reference_in.capacity : param->reference_acc.length;
+
+	//Set up output window
+	if (param->message_out.buffer && (param->message_out.buffer == param->reference_in.buffer))
+	{
+		coder_state->in_place_buffer = param->message_out.buffer;
+		coder_state->journal = param->journal;
+		coder_state->output_buffer = coder_state->window_buffer;
+		coder_state->output_capacity = OUTPUT_WINDOW;
+	}
+	else if (param->message_out.buffer)
+	{
+		coder_state->output_buffer = param->message_out.buffer;
+		coder_state->output_capacity = param->message_out.capacity;
+	}
+	else
+	{
+		coder_state->output_writer = param->message_wr;
+		coder_state->output_buffer = coder_state->window_buffer;
+		coder_state->output_capacity = OUTPUT_WINDOW;
+	}
+	coder_state->output_base = coder_state->output_fill = coder_state->output_flushed = 0U;
+	coder_state->copy_offset = coder_state->copy_length = 0U;
+	mpatch_md5_init(&coder_state->output_md5);
+}
+
+static mpatch_error_t _read_literal(const mpatch_reader_t *const input, decd_state_t *const coder_state, uint_fast32_t *const literal_len)
+{
+	const uint_fast32_t limit = (uint_fast32_t)min_uint64(MAX_LITERAL_LEN, coder_state->segment_end - output_position(coder_state));
+
+	//Read literal type
+	bool compressed;
+	if (!read_bit(&compressed, input, &coder_state->input_state))
+	{
+		return MPATCH_IO_ERROR;
+	}
+
+	uint8_t *const output_ptr = coder_state->output_buffer + coder_state->output_fill;
+
+	//Compressed literal?
+	if (compressed)
+	{
+		const uint_fast32_t compressed_size = *literal_len;
+		if (compressed_size >= limit)
+		{
+			return MPATCH_DATA_CORRUPTED;
+		}
+		if (!read_bytes(coder_state->literal_buffer, compressed_size, input, &coder_state->input_state))
+		{
+			return MPATCH_IO_ERROR;
+		}
+		if (!_prepare_dictionary(coder_state))
+		{
+			return MPATCH_INTERNAL_ERROR;
+		}
+		if (!mpatch_compress_dec_next(coder_state->dctx, coder_state->literal_buffer, compressed_size, output_ptr, limit, literal_len))
+		{
+			return MPATCH_DATA_CORRUPTED;
+		}
+		return ((*literal_len > COMPRESS_THRESHOLD) && (*literal_len > compressed_size)) ? MPATCH_SUCCESS : MPATCH_DATA_CORRUPTED;
+	}
+
+	//Uncompressed literal
+	if (*literal_len > limit)
+	{
+		return MPATCH_DATA_CORRUPTED;
+	}
+	if (*literal_len > COMPRESS_THRESHOLD)
+	{
+		if (!_prepare_dictionary(coder_state))
+		{
+			return MPATCH_INTERNAL_ERROR;
+		}
+	}
+	return read_bytes(output_ptr, *literal_len, input, &coder_state->input_state) ? MPATCH_SUCCESS : MPATCH_IO_ERROR;
+}
+
+static mpatch_error_t _copy_substring(const uint64_t offset, const uint64_t length, decd_state_t *const coder_state)
+{
+	//Copy in pieces that fit into the output window (and may be committed in between)
+	const bool windowed = (coder_state->output_buffer == coder_state->window_buffer);
+	for (uint64_t copy_pos = 0U; copy_pos < length;)
+	{
+		const uint64_t copy_len = windowed ? min_uint64(length - copy_pos, COMMIT_SIZE) : length;
+		coder_state->copy_offset = offset + copy_pos;
+		coder_state->copy_length = length - copy_pos;
+		if (!_reserve_output(copy_len, coder_state))
+		{
+			return MPATCH_IO_ERROR;
+		}
+		if (!_copy_reference(coder_state->output_buffer + coder_state->output_fill, offset + copy_pos, copy_len, coder_state))
+		{
+			return MPATCH_IO_ERROR;
+		}
+		coder_state->output_fill += copy_len;
+		copy_pos += copy_len;
+	}
+	coder_state->copy_length = 0U;
+	return MPATCH_SUCCESS;
+}
+
+static mpatch_error_t _read_substring(const mpatch_reader_t *const input, decd_state_t *const coder_state, const uint64_t length)
+{
+	//Read offset
+	uint64_t offset_diff;
+	bool offset_sign = SUBSTR_BWD;
+	if (!exp_golomb_read(&offset_diff, input, &coder_state->input_state))
+	{
+		return MPATCH_IO_ERROR;
+	}
+	if (offset_diff > 0U)
+	{
+		if (!read_bit(&offset_sign, input, &coder_state->input_state))
+		{
+			return MPATCH_IO_ERROR;
+		}
+	}
+
+	//Compute and validate source range
+	if (offset_sign ? (offset_diff > coder_state->reference_len - coder_state->prev_offset) : (offset_diff > coder_state->prev_offset))
+	{
+		return MPATCH_DATA_CORRUPTED;
+	}
+	const uint64_t offset = offset_sign ? (coder_state->prev_offset + offset_diff) : (coder_state->prev_offset - offset_diff);
+	if ((length > coder_state->reference_len - offset) || (length > coder_state->segment_end - output_position(coder_state)) || (coder_state->in_place && (offset < output_position(coder_state))))
+	{
+		return MPATCH_DATA_CORRUPTED;
+	}
+
+	//Copy from reference
+	coder_state->prev_offset = offset + length;
+	return _copy_substring(offset, length, coder_state);
+}
+
+static mpatch_error_t decode_chunk(const mpatch_reader_t *const input, decd_state_t *const coder_state)
+{
+	mpatch_error_t result;
+
+	//Make room in the output window
+	if (!_reserve_output(min_uint64(MAX_LITERAL_LEN, coder_state->segment_end - output_position(coder_state)), coder_state))
+	{
+		return MPATCH_IO_ERROR;
+	}
+
+	//Read literal
+	uint64_t literal_code;
+	if (!exp_golomb_read(&literal_code, input, &coder_state->input_state))
+	{
+		return MPATCH_IO_ERROR;
+	}
+	if (literal_code > MAX_LITERAL_LEN)
+	{
+		return MPATCH_DATA_CORRUPTED;
+	}
+	uint_fast32_t literal_len = (uint_fast32_t)literal_code;
+	if (literal_len)
+	{
+		if ((result = _read_literal(input, coder_state, &literal_len)) != MPATCH_SUCCESS)
+		{
+			return result;
+		}
+		coder_state->output_fill += literal_len;
+	}
+
+	//Read substring
+	uint64_t length;
+	if (!exp_golomb_read(&length, input, &coder_state->input_state))
+	{
+		return MPATCH_IO_ERROR;
+	}
+	if (length > UINT64_MAX - SUBSTRING_THRESHOLD)
+	{
+		return MPATCH_DATA_CORRUPTED;
+	}
+	if (length)
+	{
+		length += SUBSTRING_THRESHOLD;
+		if ((result = _read_substring(input, coder_state, length)) != MPATCH_SUCCESS)
+		{
+			return result;
+		}
+	}
+	else if (!literal_len)
+	{
+		return MPATCH_DATA_CORRUPTED; /*empty chunks are never written*/
+	}
+
+	return MPATCH_SUCCESS;
+}
+
+static mpatch_error_t resume_decd_state(const mpatch_reader_t *const input, const mpatch_checkpoint_t *const checkpoint, decd_state_t *const coder_state)
+{
+	//Validate checkpoint
+	if ((checkpoint->output_pos > coder_state->output_len) || (checkpoint->prev_offset > coder_state->reference_len) || (checkpoint->copy_offset > coder_state->reference_len) ||
+		(checkpoint->copy_length > coder_state->reference_len - checkpoint->copy_offset) || (checkpoint->copy_length > coder_state->output_len - checkpoint->output_pos))
+	{
+		return MPATCH_INVALID_PARAMETER;
+	}
+
+	//Restore the committed output
+	const uint_fast32_t keep_len = (uint_fast32_t)min_uint64(DICT_TAIL, checkpoint->output_pos);
+	mpatch_md5_update(&coder_state->output_md5, coder_state->in_place_buffer, (size_t)checkpoint->output_pos);
+	memcpy(coder_state->output_buffer, coder_state->in_place_buffer + (checkpoint->output_pos - keep_len), keep_len);
+	coder_state->output_base = checkpoint->output_pos - keep_len;
+	coder_state->output_fill = coder_state->output_flushed = keep_len;
+
+	//Restore the input position
+	if (!skip_bits(checkpoint->input_bits, input, &coder_state->input_state))
+	{
+		return MPATCH_IO_ERROR;
+	}
+
+	//Complete the pending copy
+	coder_state->prev_offset = checkpoint->prev_offset;
+	return checkpoint->copy_length ? _copy_substring(checkpoint->copy_offset, checkpoint->copy_length, coder_state) : MPATCH_SUCCESS;
+}
+
+/* ======================================================================= */
+/* Segment functions                                                       */
+/* ======================================================================= */
+
+/*
+ * Every segment is decoded with a fresh "prev_offset" and literal compressor state. A segment that is decoded on its own
+ * takes its input from the slice of the stream given by the segment index; after its last chunk, the input must be at
+ * the end of that slice, and the CRC-32 of the output must match the index entry. Segment tasks each own a decoder
+ * state and decode every "segment_step"-th segment, starting at "segment_first", directly into the output buffer.
+ */
+
+typedef struct CACHE_ALIGN
+{
+	decd_state_t *coder_state;
+	const uint8_t *stream;
+	uint64_t stream_len;
+	const segment_entry_t *index;
+	uint_fast32_t segment_first;
+	uint_fast32_t segment_step;
+	uint_fast32_t segment_count;
+	uint_fast32_t segment_size;
+	mpatch_error_t result;
+}
+segment_task_t;
+
+static void init_segment(decd_state_t *const coder_state, const uint64_t segment_start, const uint64_t segment_end)
+{
+	coder_state->segment_start = segment_start;
+	coder_state->segment_end = segment_end;
+	coder_state->prev_offset = 0U;
+	coder_state->block_id = UINT64_MAX;
+}
+
+static mpatch_error_t decode_segment(decd_state_t *const coder_state, const segment_task_t *const task, const uint_fast32_t segment_idx)
+{
+	mpatch_reader_t input;
+	memset(&input, 0, sizeof(mpatch_reader_t));
+
+	//Locate the segment
+	uint64_t offset, length;
+	if (!segment_slice(task->index, segment_idx, task->segment_count, task->segment_size, task->stream_len, &offset, &length))
+	{
+		return MPATCH_DATA_CORRUPTED;
+	}
+	const uint64_t output_start = ((uint64_t)segment_idx) * task->segment_size;
+	const uint64_t output_end = segment_end(output_start, task->segment_size, coder_state->output_len);
+
+	//Decode all chunks of the segment
+	init_io_state(&coder_state->input_state);
+	set_input_buffer(&coder_state->input_state, task->stream + offset, length);
+	init_segment(coder_state, output_start, output_end);
+	coder_state->output_fill = output_start - coder_state->output_base;
+	while (output_position(coder_state) < output_end)
+	{
+		if (is_cancelled(coder_state->cancel))
+		{
+			return MPATCH_CANCELLED_BY_USER;
+		}
+		const mpatch_error_t result = decode_chunk(&input, coder_state);
+		if (result != MPATCH_SUCCESS)
+		{
+			return (result == MPATCH_IO_ERROR) ? MPATCH_DATA_CORRUPTED : result;
+		}
+	}
+	if (!(align_input(&coder_state->input_state) && (input_position(&coder_state->input_state) == length)))
+	{
+		return MPATCH_DATA_CORRUPTED;
+	}
+
+	//Verify the output
+	uint8_t checksum[4U];
+	mpatch_crc32_compute(coder_state->output_buffer + (output_start - coder_state->output_base), (size_t)(output_end - output_start), checksum);
+	return memcmp(checksum, task->index[segment_idx].crc32, 4U) ? MPATCH_CHECKSUM_MISMATCH : MPATCH_SUCCESS;
+}
+
+static void decode_segments(const uintptr_t user_data)
+{
+	segment_task_t *const task = (segment_task_t*)user_data;
+	task->result = MPATCH_SUCCESS;
+	for (uint_fast32_t segment_idx = task->segment_first; segment_idx < task->segment_count; segment_idx += task->segment_step)
+	{
+		if ((task->result = decode_segment(task->coder_state, task, segment_idx)) != MPATCH_SUCCESS)
+		{
+			return;
+		}
+	}
+}
@@ -0,0 +1,83 @@
+/* ---------------------------------------------------------------------------------------------- */
+/* MPatchLib - patch and compression library                                                      */
+/* Copyright(c) 2018 LoRd_MuldeR <mulder2@gmx.de>                                                 */
+/*                                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy of this software  */
+/* and associated documentation files (the "Software"), to deal in the Software without           */
+/* restriction, including without limitation the rights to use, copy, modify, merge, publish,     */
+/* distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the  */
+/* Software is furnished to do so, subject to the following conditions:                           */
+/*                                                                                                */
+/* The above copyright notice and this permission notice shall be included in all copies or       */
+/* substantial portions of the Software.                                                          */
+/*                                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING  */
+/* BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND     */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,   */
+/* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.        */
+/* ---------------------------------------------------------------------------------------------- */
+
+
+#ifndef _INC_MPATCH_DICTIONARY_H
+#define _INC_MPATCH_DICTIONARY_H
+
+#include "utils.h"
+
+#define COMPRESS_THRESHOLD 5U
+#define MAX_LITERAL_LEN 2048U
+#define LITERAL_BLOCK 65536U
+#define DICT_SIZE 32768U
+#define DICT_TAIL 16384U
+#define DICT_WINDOW 4096U
+#define DICT_UPDATE 4096U
+
+/*
+ * The message is divided into blocks of LITERAL_BLOCK bytes, and each literal belongs to the block in which it starts.
+ * The literal compressor is reset at the first literal of each block that is a candidate for compression (i.e. its
+ * length exceeds COMPRESS_THRESHOLD), so blocks can be compressed independently. It is then primed with up to DICT_TAIL
+ * bytes of the message preceding that literal, appended after a window of the reference around the current "prev_offset",
+ * so that the total dictionary does not exceed DICT_SIZE bytes. Within the block, a window of DICT_WINDOW bytes is
+ * appended whenever the reference window has moved by at least DICT_UPDATE bytes. Encoder and decoder both follow these
+ * rules, using the functions below, so that their dictionaries always match. For in-place patches, the reference before
+ * the current message position has already been overwritten, so reference windows are clamped to start at that position.
+ * For segmented patches, the message tail never reaches back beyond the start of the current segment.
+ */
+
+typedef struct
+{
+	uint64_t offset;
+	uint_fast32_t length;
+	uint_fast32_t tail_len;
+}
+dict_window_t;
+
+static __forceinline uint64_t dict_reference_base(const uint64_t message_pos, const uint64_t reference_len, const bool in_place)
+{
+	return in_place ? min_uint64(message_pos, reference_len) : 0U;
+}
+
+static __forceinline uint64_t dict_window_offset(const uint64_t prev_offset, const uint_fast32_t window_len, const uint64_t reference_base, const uint64_t reference_len)
+{
+	const uint64_t offset = (prev_offset > reference_base + (DICT_WINDOW / 4U)) ? (prev_offset - (DICT_WINDOW / 4U)) : reference_base;
+	return min_uint64(offset, reference_len - window_len);
+}
+
+static __forceinline void dict_prime_window(dict_window_t *const window, const uint64_t message_pos, const uint64_t segment_pos, const uint64_t prev_offset, const uint64_t reference_len, const bool in_place)
+{
+	const uint64_t reference_base = dict_reference_base(message_pos, reference_len, in_place);
+	window->tail_len = (uint_fast32_t)min_uint64(DICT_TAIL, message_pos - segment_pos);
+	window->length = (uint_fast32_t)min_uint64(DICT_SIZE - window->tail_len, reference_len - reference_base);
+	window->offset = dict_window_offset(prev_offset, window->length, reference_base, reference_len);
+}
+
+static __forceinline bool dict_update_window(dict_window_t *const window, const uint64_t message_pos, const uint64_t dict_offset, const uint64_t prev_offset, const uint64_t reference_len, const bool in_place)
+{
+	const uint64_t reference_base = dict_reference_base(message_pos, reference_len, in_place);
+	window->tail_len = 0U;
+	window->length = (uint_fast32_t)min_uint64(DICT_WINDOW, reference_len - reference_base);
+	window->offset = dict_window_offset(prev_offset, window->length, reference_base, reference_len);
+	return window->length && (diff_uint64(window->offset, dict_offset) >= DICT_UPDATE);
+}
+
+#endif /*_INC_MPATCH_DICTIONARY_H*/
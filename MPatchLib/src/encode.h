@@ -22,27 +22,111 @@
 #include "utils.h"
 #include "substring.h"
 #include "compress.h"
+#include "dictionary.h"
+#include "segment.h"
 
 #include <stdlib.h>
 
-#define COMPRESS_THRESHOLD 5U
 #define LITERAL_LEN_COUNT 32U
-#define MAX_LITERAL_LEN 2048U
+#define EFFORT_LEVELS 4U
+#define MIN_JOB_CAPACITY 1024U
 
 static const uint_fast32_t SUBSTR_SRC = 0U;
 static const uint_fast32_t SUBSTR_REF = 1U;
 
+/*
+ * The encoder reads the message through a window, which holds the bytes from "base" up to "limit" (exclusive), while
+ * "length" is the total length of the message, or UINT64_MAX as long as it is not known yet. The one-shot encoder
+ * passes the whole message at once, whereas the streaming encoder slides the window over the message as it arrives.
+ * Chunks never reach beyond "limit", and the window must still hold the literals of all pending chunks, as well as
+ * the DICT_TAIL bytes before them.
+ */
 typedef struct
 {
-	io_state_t output_state;
+	const uint8_t *buffer;
+	uint64_t base;
+	uint64_t limit;
+	uint64_t length;
+}
+input_window_t;
+
+static __forceinline const uint8_t *input_ptr(const input_window_t *const input, const uint64_t position)
+{
+	return input->buffer + (size_t)(position - input->base);
+}
+
+typedef struct
+{
+	uint64_t input_pos;
+	uint_fast32_t literal_len;
+	uint64_t prev_offset;
+	substring_t substr;
+	uint_fast32_t compressed_size;
+	const uint8_t *compressed_data;
+}
+chunk_job_t;
+
+typedef struct CACHE_ALIGN
+{
 	mpatch_cctx_t *cctx;
-	uint_fast32_t prev_offset;
+	uint8_t *buffer;
+	const input_window_t *input;
+	const mpatch_rd_buffer_t *reference_buffer;
+	chunk_job_t *jobs;
+	uint_fast32_t job_first;
+	uint_fast32_t job_count;
+	uint_fast32_t segment_size;
+	uint_fast32_t effort;
+	uint64_t dict_offset;
+	bool primed;
+	bool in_place;
+	bool success;
+}
+block_task_t;
+
+typedef struct
+{
+	io_state_t output_state;
+	uint64_t prev_offset;
+	uint_fast32_t segment_size;
+	uint64_t segment_end;
+	segment_entry_t *segment_index;
+	uint_fast32_t segment_capacity;
+	uint32_t segment_crc;
+	bool in_place;
 	struct
 	{
-		uint_fast32_t literal_bytes;
-		uint_fast32_t substring_bytes;
-		uint_fast32_t saved_bytes;
-		uint_fast32_t literal_hist[MAX_LITERAL_LEN + 1U];
+		chunk_job_t *jobs;
+		uint_fast32_t count;
+		uint_fast32_t capacity;
+		uint64_t block_id;
+		uint_fast32_t block_count;
+		uint_fast32_t max_blocks;
+		uint64_t task_memory;
+		block_task_t *tasks;
+		pool_task_t *task_queue;
+	}
+	pending;
+	search_state_t search;
+	struct
+	{
+		uint64_t deadline;
+		uint64_t next_check;
+		uint64_t level_time;
+		uint64_t level_bytes;
+		uint64_t bytes_done;
+		double rate[EFFORT_LEVELS];
+		uint_fast32_t level;
+	}
+	effort;
+	struct
+	{
+		uint64_t literal_bytes;
+		uint64_t substring_bytes;
+		uint64_t saved_bytes;
+		uint64_t literal_hist[MAX_LITERAL_LEN + 1U];
+		uint64_t effort_bytes[EFFORT_LEVELS];
+		uint64_t worker_memory; /*held by the segment workers, until they are destroyed*/
 	}
 	stats;
 }
@@ -53,39 +137,206 @@ static const uint32_t LITERAL_LEN[LITERAL_LEN_COUNT] =
 	0U, 1U, 2U, 3U, 5U, 7U, 10U, 13U, 17U, 22U, 28U, 35U, 44U, 55U, 68U, 84U, 103U, 126U, 154U, 189U, 231U, 282U, 344U, 420U, 513U, 626U, 763U, 930U, 1133U, 1380U, 1681U, 2048U
 };
 
+/*
+ * With a time budget, the encoder measures its input rate at the current effort level and steps the effort down, if
+ * the remaining input would not be finished before the deadline at that rate, or back up, if the rate that was measured
+ * at the next better level would do. Level 1 skips the refinement of the literal length, level 2 tries fewer literal
+ * lengths, level 3 tries even fewer and only searches a window around the previous offset. The literal compressor is
+ * switched to the corresponding (faster) effort at the start of each block.
+ */
+static const uint_fast32_t EFFORT_LITERAL_COUNT[EFFORT_LEVELS] = { LITERAL_LEN_COUNT, LITERAL_LEN_COUNT, 20U, 12U };
+static const uint_fast32_t EFFORT_SEARCH_WINDOW[EFFORT_LEVELS] = { 0U, 0U, 0U, 8388608U };
+
+#define EFFORT_CHECK_INTERVAL 10000000U /*nanoseconds*/
+#define EFFORT_MIN_SAMPLE 50000000U /*nanoseconds*/
+#define EFFORT_MARGIN 1.125
+
 /* ======================================================================= */
-/* Encoder functions                                                       */
+/* Dictionary functions                                                    */
 /* ======================================================================= */
 
-static bool _write_chunk(const uint8_t *const input_ptr, const mpatch_writer_t *const output, encd_state_t *const coder_state, const uint_fast32_t optimal_literal_len, const substring_t *const optimal_substr)
+static bool _prime_dictionary(block_task_t *const task, const chunk_job_t *const job, uint64_t *const dict_offset)
 {
-	//Update histogram
-	coder_state->stats.literal_hist[optimal_literal_len]++;
+	dict_window_t window;
+	dict_prime_window(&window, job->input_pos, segment_start(job->input_pos, task->segment_size), job->prev_offset, task->reference_buffer->capacity, task->in_place);
+	if (!(mpatch_compress_enc_reset(task->cctx) && mpatch_compress_enc_effort(task->cctx, task->effort) && mpatch_compress_enc_load(task->cctx, task->reference_buffer->buffer + window.offset, window.length)))
+	{
+		return false;
+	}
+	*dict_offset = window.offset;
+	return window.tail_len ? mpatch_compress_enc_load(task->cctx, input_ptr(task->input, job->input_pos - window.tail_len), window.tail_len) : true;
+}
 
-	//Write literal
-	if (optimal_literal_len)
+static bool _update_dictionary(block_task_t *const task, const chunk_job_t *const job, uint64_t *const dict_offset)
+{
+	dict_window_t window;
+	if (dict_update_window(&window, job->input_pos, *dict_offset, job->prev_offset, task->reference_buffer->capacity, task->in_place))
 	{
-		uint_fast32_t compressed_size = optimal_literal_len;
-		coder_state->stats.literal_bytes += optimal_literal_len;
-		if (optimal_literal_len > COMPRESS_THRESHOLD)
+		if (!mpatch_compress_enc_load(task->cctx, task->reference_buffer->buffer + window.offset, window.length))
 		{
-			if ((compressed_size = mpatch_compress_enc_test(coder_state->cctx, input_ptr, optimal_literal_len)) == UINT_FAST32_MAX)
+			return false;
+		}
+		*dict_offset = window.offset;
+	}
+	return true;
+}
+
+/* ======================================================================= */
+/* Block functions                                                         */
+/* ======================================================================= */
+
+static void _compress_block(const uintptr_t user_data)
+{
+	block_task_t *const task = (block_task_t*)user_data;
+	uint_fast32_t buffer_pos = 0U;
+
+	task->success = false;
+
+	for (uint_fast32_t job_idx = 0U; job_idx < task->job_count; ++job_idx)
+	{
+		chunk_job_t *const job = &task->jobs[task->job_first + job_idx];
+		job->compressed_size = job->literal_len;
+		job->compressed_data = NULL;
+		if (job->literal_len > COMPRESS_THRESHOLD)
+		{
+			//Prime or update the dictionary
+			if (!(task->primed ? _update_dictionary(task, job, &task->dict_offset) : _prime_dictionary(task, job, &task->dict_offset)))
 			{
-				return false;
+				return;
+			}
+			task->primed = true;
+
+			//Compress literal, if beneficial
+			const uint8_t *const literal_ptr = input_ptr(task->input, job->input_pos);
+			uint_fast32_t compressed_size;
+			if ((compressed_size = mpatch_compress_enc_test(task->cctx, literal_ptr, job->literal_len)) == UINT_FAST32_MAX)
+			{
+				return;
+			}
+			if (compressed_size < job->literal_len)
+			{
+				const uint8_t *const compressed_data = mpatch_compress_enc_next(task->cctx, literal_ptr, job->literal_len, &compressed_size);
+				if (!(compressed_data && (compressed_size < job->literal_len)))
+				{
+					return;
+				}
+				memcpy(task->buffer + buffer_pos, compressed_data, compressed_size);
+				job->compressed_data = task->buffer + buffer_pos;
+				job->compressed_size = compressed_size;
+				buffer_pos += compressed_size;
 			}
 		}
-		if (compressed_size < optimal_literal_len)
+	}
+
+	task->success = true;
+}
+
+static inline uint64_t block_task_memory(const mpatch_codec_t codec)
+{
+	return sizeof(block_task_t) + sizeof(pool_task_t) + mpatch_compress_enc_memory(codec, MAX_LITERAL_LEN) + LITERAL_BLOCK + MAX_LITERAL_LEN;
+}
+
+static bool init_block_tasks(encd_state_t *const coder_state, const mpatch_codec_t codec, const uint_fast32_t thread_count, const input_window_t *const input, const mpatch_rd_buffer_t *const reference_buffer, const bool in_place, const uint_fast32_t segment_size)
+{
+	coder_state->in_place = in_place;
+	coder_state->segment_size = segment_size;
+	coder_state->segment_end = 0U;
+	coder_state->pending.max_blocks = (thread_count > 1U) ? thread_count : 1U;
+	coder_state->pending.task_memory = block_task_memory(codec);
+	coder_state->pending.block_id = UINT64_MAX;
+	coder_state->pending.tasks = (block_task_t*)calloc_aligned(coder_state->pending.max_blocks, sizeof(block_task_t));
+	coder_state->pending.task_queue = (pool_task_t*)calloc(coder_state->pending.max_blocks, sizeof(pool_task_t));
+	if (!(coder_state->pending.tasks && coder_state->pending.task_queue))
+	{
+		return false;
+	}
+	for (uint_fast32_t t = 0U; t < coder_state->pending.max_blocks; ++t)
+	{
+		block_task_t *const task = &coder_state->pending.tasks[t];
+		task->input = input;
+		task->reference_buffer = reference_buffer;
+		task->in_place = in_place;
+		task->segment_size = segment_size;
+		if (!(mpatch_compress_enc_init(&task->cctx, codec, MAX_LITERAL_LEN) && (task->buffer = (uint8_t*)malloc((LITERAL_BLOCK + MAX_LITERAL_LEN) * sizeof(uint8_t)))))
 		{
-			const uint8_t *const compressed_data = mpatch_compress_enc_next(coder_state->cctx, input_ptr, optimal_literal_len, &compressed_size);
-			coder_state->stats.saved_bytes += (optimal_literal_len - compressed_size);
-			if (!(compressed_data && exp_golomb_write(compressed_size, output, &coder_state->output_state) && write_bit(true, output, &coder_state->output_state) && write_bytes(compressed_data, compressed_size, output, &coder_state->output_state)))
+			return false;
+		}
+	}
+	return true;
+}
+
+static void free_block_tasks(encd_state_t *const coder_state)
+{
+	if (coder_state->pending.tasks)
+	{
+		for (uint_fast32_t t = 0U; t < coder_state->pending.max_blocks; ++t)
+		{
+			block_task_t *const task = &coder_state->pending.tasks[t];
+			if (task->cctx)
+			{
+				mpatch_compress_enc_free(&task->cctx);
+			}
+			if (task->buffer)
+			{
+				free(task->buffer);
+				task->buffer = NULL;
+			}
+		}
+		free_aligned(coder_state->pending.tasks);
+		coder_state->pending.tasks = NULL;
+	}
+	if (coder_state->pending.task_queue)
+	{
+		free(coder_state->pending.task_queue);
+		coder_state->pending.task_queue = NULL;
+	}
+	free_search_state(&coder_state->search);
+	if (coder_state->pending.jobs)
+	{
+		free(coder_state->pending.jobs);
+		coder_state->pending.jobs = NULL;
+	}
+	if (coder_state->segment_index)
+	{
+		free(coder_state->segment_index);
+		coder_state->segment_index = NULL;
+	}
+}
+
+static inline uint64_t coder_base_memory(void)
+{
+	return sizeof(encd_state_t) + (MIN_JOB_CAPACITY * sizeof(chunk_job_t));
+}
+
+static uint64_t coder_memory(const encd_state_t *const coder_state)
+{
+	return sizeof(encd_state_t) + (coder_state->pending.max_blocks * coder_state->pending.task_memory) + (coder_state->pending.capacity * sizeof(chunk_job_t)) + (coder_state->segment_capacity * sizeof(segment_entry_t)) + search_state_memory(&coder_state->search);
+}
+
+/* ======================================================================= */
+/* Encoder functions                                                       */
+/* ======================================================================= */
+
+static bool _write_chunk(const chunk_job_t *const job, const input_window_t *const input, const mpatch_writer_t *const output, encd_state_t *const coder_state)
+{
+	//Update histogram
+	coder_state->stats.literal_hist[job->literal_len]++;
+
+	//Write literal
+	if (job->literal_len)
+	{
+		coder_state->stats.literal_bytes += job->literal_len;
+		if (job->compressed_data)
+		{
+			coder_state->stats.saved_bytes += (job->literal_len - job->compressed_size);
+			if (!(exp_golomb_write(job->compressed_size, output, &coder_state->output_state) && write_bit(true, output, &coder_state->output_state) && write_bytes(job->compressed_data, job->compressed_size, output, &coder_state->output_state)))
 			{
 				return false;
 			}
 		}
 		else
 		{
-			if (!(exp_golomb_write(optimal_literal_len, output, &coder_state->output_state) && write_bit(false, output, &coder_state->output_state) && write_bytes(input_ptr, optimal_literal_len, output, &coder_state->output_state)))
+			if (!(exp_golomb_write(job->literal_len, output, &coder_state->output_state) && write_bit(false, output, &coder_state->output_state) && write_bytes(input_ptr(input, job->input_pos), job->literal_len, output, &coder_state->output_state)))
 			{
 				return false;
 			}
@@ -100,16 +351,16 @@ static bool _write_chunk(const uint8_t *const input_ptr, const mpatch_writer_t *
 	}
 
 	//Write substring
-	if (optimal_substr->length > SUBSTRING_THRESHOLD)
+	if (job->substr.length > SUBSTRING_THRESHOLD)
 	{
-		coder_state->stats.substring_bytes += optimal_substr->length;
-		if (!(exp_golomb_write(optimal_substr->length - SUBSTRING_THRESHOLD, output, &coder_state->output_state) && exp_golomb_write(optimal_substr->offset_diff, output, &coder_state->output_state)))
+		coder_state->stats.substring_bytes += job->substr.length;
+		if (!(exp_golomb_write(job->substr.length - SUBSTRING_THRESHOLD, output, &coder_state->output_state) && exp_golomb_write(job->substr.offset_diff, output, &coder_state->output_state)))
 		{
 			return false;
 		}
-		if (optimal_substr->offset_diff > 0U)
+		if (job->substr.offset_diff > 0U)
 		{
-			if (!write_bit(optimal_substr->offset_sign, output, &coder_state->output_state))
+			if (!write_bit(job->substr.offset_sign, output, &coder_state->output_state))
 			{
 				return false;
 			}
@@ -117,7 +368,7 @@ static bool _write_chunk(const uint8_t *const input_ptr, const mpatch_writer_t *
 	}
 	else
 	{
-		if (optimal_substr->length)
+		if (job->substr.length)
 		{
 			abort();
 		}
@@ -130,6 +381,129 @@ static bool _write_chunk(const uint8_t *const input_ptr, const mpatch_writer_t *
 	return true;
 }
 
+static bool flush_chunks(const input_window_t *const input, const mpatch_writer_t *const output, encd_state_t *const coder_state, thread_pool_t *const thread_pool)
+{
+	const uint_fast32_t block_count = coder_state->pending.block_count;
+	if (!block_count)
+	{
+		return true;
+	}
+
+	//Compress all pending blocks, in parallel if possible
+	pool_task_t *const task_queue = coder_state->pending.task_queue;
+	for (uint_fast32_t t = 0U; t < block_count; ++t)
+	{
+		coder_state->pending.tasks[t].jobs = coder_state->pending.jobs;
+		task_queue[t].func = _compress_block;
+		task_queue[t].data = (uintptr_t)(&coder_state->pending.tasks[t]);
+	}
+	if (thread_pool && (block_count > 1U))
+	{
+		mpatch_pool_exec(thread_pool, task_queue, block_count);
+	}
+	else
+	{
+		for (uint_fast32_t t = 0U; t < block_count; ++t)
+		{
+			_compress_block(task_queue[t].data);
+		}
+	}
+
+	//Emit the chunks in their original order
+	for (uint_fast32_t t = 0U; t < block_count; ++t)
+	{
+		if (!coder_state->pending.tasks[t].success)
+		{
+			return false;
+		}
+	}
+	for (uint_fast32_t job_idx = 0U; job_idx < coder_state->pending.count; ++job_idx)
+	{
+		if (!_write_chunk(&coder_state->pending.jobs[job_idx], input, output, coder_state))
+		{
+			return false;
+		}
+	}
+
+	coder_state->pending.count = coder_state->pending.block_count = 0U;
+	return true;
+}
+
+/*
+ * Flushing in the middle of a block (e.g. to move the input window) must not restart the literal compressor, because
+ * the decoder resets it only once per block. Therefore, the compressor of the last block is carried over to the first
+ * task, which then continues that block.
+ */
+static bool flush_chunks_midblock(const input_window_t *const input, const mpatch_writer_t *const output, encd_state_t *const coder_state, thread_pool_t *const thread_pool)
+{
+	const uint_fast32_t block_count = coder_state->pending.block_count;
+	if (!flush_chunks(input, output, coder_state, thread_pool))
+	{
+		return false;
+	}
+	if (block_count)
+	{
+		block_task_t *const first = &coder_state->pending.tasks[0U], *const last = &coder_state->pending.tasks[block_count - 1U];
+		if (last != first)
+		{
+			mpatch_cctx_t *const cctx = first->cctx;
+			first->cctx = last->cctx;
+			last->cctx = cctx;
+			first->effort = last->effort;
+			first->dict_offset = last->dict_offset;
+			first->primed = last->primed;
+		}
+		first->job_first = first->job_count = 0U;
+		coder_state->pending.block_count = 1U;
+	}
+	return true;
+}
+
+static bool _push_chunk(const input_window_t *const input, const uint64_t input_pos, const mpatch_writer_t *const output, encd_state_t *const coder_state, thread_pool_t *const thread_pool, const uint_fast32_t literal_len, const substring_t *const substr)
+{
+	//Start a new block, if required
+	const uint64_t block_id = input_pos / LITERAL_BLOCK;
+	if ((!coder_state->pending.block_count) || (block_id != coder_state->pending.block_id))
+	{
+		if (coder_state->pending.block_count >= coder_state->pending.max_blocks)
+		{
+			if (!flush_chunks(input, output, coder_state, thread_pool))
+			{
+				return false;
+			}
+		}
+		block_task_t *const task = &coder_state->pending.tasks[coder_state->pending.block_count++];
+		task->job_first = coder_state->pending.count;
+		task->job_count = 0U;
+		task->effort = coder_state->effort.level;
+		task->dict_offset = 0U;
+		task->primed = false;
+		coder_state->pending.block_id = block_id;
+	}
+
+	//Grow the job queue, if required
+	if (coder_state->pending.count >= coder_state->pending.capacity)
+	{
+		const uint_fast32_t capacity = coder_state->pending.capacity ? (2U * coder_state->pending.capacity) : MIN_JOB_CAPACITY;
+		chunk_job_t *const jobs = (chunk_job_t*)realloc(coder_state->pending.jobs, capacity * sizeof(chunk_job_t));
+		if (!jobs)
+		{
+			return false;
+		}
+		coder_state->pending.jobs = jobs;
+		coder_state->pending.capacity = capacity;
+	}
+
+	//Append the job
+	chunk_job_t *const job = &coder_state->pending.jobs[coder_state->pending.count++];
+	job->input_pos = input_pos;
+	job->literal_len = literal_len;
+	job->prev_offset = coder_state->prev_offset;
+	memcpy(&job->substr, substr, sizeof(substring_t));
+	coder_state->pending.tasks[coder_state->pending.block_count - 1U].job_count++;
+	return true;
+}
+
 static void _update_encd_state(encd_state_t *const coder_state, const substring_t *const optimal_substr)
 {
 	if (optimal_substr->length > 1U)
@@ -142,13 +516,15 @@ static void _update_encd_state(encd_state_t *const coder_state, const substring_
 	}
 }
 
-static uint_fast32_t encode_chunk(const mpatch_rd_buffer_t *const input_buffer, const uint_fast32_t input_pos, const mpatch_rd_buffer_t *const reference_buffer, const mpatch_writer_t *const output, encd_state_t *const coder_state, thread_pool_t *const thread_pool, const mpatch_logger_t *const logger)
+static uint64_t encode_chunk(const input_window_t *const input, const uint64_t input_pos, const mpatch_rd_buffer_t *const reference_buffer, const mpatch_writer_t *const output, encd_state_t *const coder_state, thread_pool_t *const thread_pool, const mpatch_logger_t *const logger)
 {
 	//Step size LUT
 	//static const uint_fast32_t STEP_SIZE[18U] = { (uint_fast32_t)(-1), 1U, 1U, 2U, 3U, 4U, 6U, 8U, 11U, 16U, 23U, 32U, 45U, 64U, 91U, 128U, 181U, 256U };
 
 	//Set up limits
-	const uint_fast32_t remaining = input_buffer->capacity - input_pos;
+	const uint64_t remaining = min_uint64(coder_state->segment_end, input->limit) - input_pos;
+	const uint_fast32_t effort = coder_state->effort.level;
+	coder_state->search.window = EFFORT_SEARCH_WINDOW[effort];
 	
 	//Keep the "optimal" settings
 	substring_t optimal_substr = { 0U, 0U, false };
@@ -156,10 +532,10 @@ static uint_fast32_t encode_chunk(const mpatch_rd_buffer_t *const input_buffer,
 	uint64_t optimal_score = 0U;
 
 	//Find the "optimal" encoding of the next chunk
-	for (uint_fast32_t literal_len_idx = 0U; (literal_len_idx < LITERAL_LEN_COUNT) && (LITERAL_LEN[literal_len_idx] <= remaining); ++literal_len_idx)
+	for (uint_fast32_t literal_len_idx = 0U; (literal_len_idx < EFFORT_LITERAL_COUNT[effort]) && (LITERAL_LEN[literal_len_idx] <= remaining); ++literal_len_idx)
 	{
 		substring_t substr_data;
-		const uint64_t score = find_optimal_substring(&substr_data, coder_state->prev_offset, thread_pool, input_buffer->buffer + input_pos + LITERAL_LEN[literal_len_idx], remaining - LITERAL_LEN[literal_len_idx], reference_buffer->buffer, reference_buffer->capacity);
+		const uint64_t score = find_optimal_substring(&substr_data, coder_state->prev_offset, thread_pool, &coder_state->search, input_ptr(input, input_pos + LITERAL_LEN[literal_len_idx]), remaining - LITERAL_LEN[literal_len_idx], reference_buffer->buffer, coder_state->in_place ? (input_pos + LITERAL_LEN[literal_len_idx]) : 0U, reference_buffer->capacity);
 		if (score > optimal_score)
 		{
 			optimal_literal_idx = literal_len_idx;
@@ -174,18 +550,18 @@ static uint_fast32_t encode_chunk(const mpatch_rd_buffer_t *const input_buffer,
 	}
 
 	//Refine the "optimal" encoding
-	uint_fast32_t optimal_literal_len = min_uint32(remaining, MAX_LITERAL_LEN);
+	uint_fast32_t optimal_literal_len = (uint_fast32_t)min_uint64(remaining, MAX_LITERAL_LEN);
 	if (optimal_literal_idx != UINT_FAST32_MAX)
 	{
 		optimal_literal_len = LITERAL_LEN[optimal_literal_idx];
-		if (optimal_literal_idx > 3U)
+		if ((optimal_literal_idx > 3U) && (!effort))
 		{
 			const uint_fast32_t refine_init = LITERAL_LEN[optimal_literal_idx] - LITERAL_LEN[optimal_literal_idx - 1U];
 			for (uint32_t refine_step = div2ceil_uint32(refine_init); refine_step; refine_step = div2ceil_uint32(refine_step))
 			{
 				const uint32_t literal_len = optimal_literal_len - refine_step;
 				substring_t substr_data;
-				const uint64_t score = find_optimal_substring(&substr_data, coder_state->prev_offset, thread_pool, input_buffer->buffer + input_pos + literal_len, remaining - literal_len, reference_buffer->buffer, reference_buffer->capacity);
+				const uint64_t score = find_optimal_substring(&substr_data, coder_state->prev_offset, thread_pool, &coder_state->search, input_ptr(input, input_pos + literal_len), remaining - literal_len, reference_buffer->buffer, coder_state->in_place ? (input_pos + literal_len) : 0U, reference_buffer->capacity);
 				if (score > optimal_score)
 				{
 					optimal_literal_len = literal_len;
@@ -205,24 +581,290 @@ static uint_fast32_t encode_chunk(const mpatch_rd_buffer_t *const input_buffer,
 		}
 		if (optimal_substr.length > SUBSTRING_THRESHOLD)
 		{
-			logger->logging_func("%016lu, %016llu, %016lu, %016lu, %s, %016lu\n", logger->user_data, input_pos, optimal_score, optimal_literal_len,
+			logger->logging_func("%016llu, %016llu, %016lu, %016llu, %s, %016llu\n", logger->user_data, input_pos, optimal_score, optimal_literal_len,
 				optimal_substr.length, optimal_substr.offset_diff ? (optimal_substr.offset_sign ? "-->" : "<--") : "~~~", optimal_substr.offset_diff);
 		}
 		else
 		{
-			logger->logging_func("%016lu, %016llu, %016lu, %016lu\n", logger->user_data, input_pos, optimal_score, optimal_literal_len, optimal_substr.length);
+			logger->logging_func("%016llu, %016llu, %016lu, %016llu\n", logger->user_data, input_pos, optimal_score, optimal_literal_len, optimal_substr.length);
 		}
 	}
 
-	//Write "optimal" encoding to output now!
-	if (!_write_chunk(input_buffer->buffer + input_pos, output, coder_state, optimal_literal_len, &optimal_substr))
+	//Queue "optimal" encoding for output
+	if (!_push_chunk(input, input_pos, output, coder_state, thread_pool, optimal_literal_len, &optimal_substr))
 	{
 		return 0U;
 	}
 
 	//Update coder state
 	_update_encd_state(coder_state, &optimal_substr);
+	const uint64_t chunk_len = optimal_literal_len + optimal_substr.length;
+	if (coder_state->segment_index)
+	{
+		mpatch_crc32_update(&coder_state->segment_crc, input_ptr(input, input_pos), (size_t)chunk_len);
+	}
 
 	//Return total number of "used" bytes
-	return optimal_literal_len + optimal_substr.length;
+	return chunk_len;
+}
+
+/* ======================================================================= */
+/* Effort functions                                                        */
+/* ======================================================================= */
+
+static void init_effort(encd_state_t *const coder_state, const uint64_t deadline)
+{
+	const uint64_t now = mpatch_pool_clock();
+	memset(&coder_state->effort, 0, sizeof(coder_state->effort));
+	coder_state->effort.deadline = deadline;
+	coder_state->effort.level_time = now;
+	coder_state->effort.next_check = deadline ? min_uint64(now + EFFORT_CHECK_INTERVAL, deadline) : 0U; /*a short budget must not expire unnoticed*/
+}
+
+static void _set_effort(encd_state_t *const coder_state, const uint_fast32_t level, const uint64_t now)
+{
+	coder_state->effort.level = level;
+	coder_state->effort.level_time = now;
+	coder_state->effort.level_bytes = coder_state->effort.bytes_done;
+}
+
+static void update_effort(encd_state_t *const coder_state, const uint64_t chunk_len, const uint64_t bytes_left)
+{
+	const uint_fast32_t level = coder_state->effort.level;
+	coder_state->effort.bytes_done += chunk_len;
+	coder_state->stats.effort_bytes[level] += chunk_len;
+
+	//Check the progress from time to time, if there is a deadline
+	if (!coder_state->effort.deadline)
+	{
+		return;
+	}
+	const uint64_t now = mpatch_pool_clock();
+	if (now < coder_state->effort.next_check)
+	{
+		return;
+	}
+	coder_state->effort.next_check = (now < coder_state->effort.deadline) ? min_uint64(now + EFFORT_CHECK_INTERVAL, coder_state->effort.deadline) : (now + EFFORT_CHECK_INTERVAL);
+
+	//Out of time already?
+	if (now >= coder_state->effort.deadline)
+	{
+		if (level < EFFORT_LEVELS - 1U)
+		{
+			_set_effort(coder_state, EFFORT_LEVELS - 1U, now);
+		}
+		return;
+	}
+
+	//Measure the rate at the current level
+	const uint64_t elapsed = now - coder_state->effort.level_time;
+	if (elapsed < EFFORT_MIN_SAMPLE)
+	{
+		return;
+	}
+	double *const rate = coder_state->effort.rate;
+	rate[level] = (double)(coder_state->effort.bytes_done - coder_state->effort.level_bytes) / elapsed;
+
+	//Step down, if the deadline cannot be met at this rate, or back up, if the better level was measured to be fast enough
+	const double required = ((double)bytes_left / (coder_state->effort.deadline - now)) * EFFORT_MARGIN;
+	if ((rate[level] < required) && (level < EFFORT_LEVELS - 1U))
+	{
+		_set_effort(coder_state, level + 1U, now);
+	}
+	else if (level && (rate[level - 1U] > required))
+	{
+		_set_effort(coder_state, level - 1U, now);
+	}
+}
+
+/* ======================================================================= */
+/* Segment functions                                                       */
+/* ======================================================================= */
+
+/*
+ * Segments are either encoded one after another, or, if multiple threads are available, each segment is encoded as a
+ * whole by a single worker, with its own encoder state and literal compressor, into a separate buffer. In the latter
+ * case, the workers still submit their substring searches to the pool, but these are only split up by threads that
+ * would be idle otherwise (e.g. when fewer segments than threads are left). The encoded segments are then appended to
+ * the output in their original order. Both ways produce exactly the same patch.
+ */
+
+typedef struct CACHE_ALIGN
+{
+	encd_state_t *coder_state;
+	const input_window_t *input;
+	const mpatch_rd_buffer_t *reference_buffer;
+	thread_pool_t *thread_pool;
+	uint64_t input_pos;
+	uint64_t bytes_after; /*input that is left for this worker after the segment (estimated), for the time budget*/
+	uint8_t *data;
+	uint64_t length;
+	uint64_t capacity;
+	uint8_t crc32[4U];
+	bool success;
+}
+segment_job_t;
+
+static bool init_segment_index(encd_state_t *const coder_state, const input_window_t *const input)
+{
+	if (coder_state->segment_size)
+	{
+		coder_state->segment_capacity = (input->length != UINT64_MAX) ? segment_count(input->length, coder_state->segment_size) : 64U;
+		return BOOLIFY(coder_state->segment_index = (segment_entry_t*)calloc(coder_state->segment_capacity, sizeof(segment_entry_t)));
+	}
+	return true;
+}
+
+static bool _grow_segment_index(encd_state_t *const coder_state, const uint64_t segment_idx)
+{
+	if (segment_idx >= UINT32_MAX)
+	{
+		return false; /*see valid_segment_count()*/
+	}
+	const uint_fast32_t capacity = (uint_fast32_t)max_uint64(segment_idx + 1U, min_uint64(2U * ((uint64_t)coder_state->segment_capacity), UINT32_MAX));
+	segment_entry_t *const segment_index = (segment_entry_t*)realloc(coder_state->segment_index, capacity * sizeof(segment_entry_t));
+	if (!segment_index)
+	{
+		return false;
+	}
+	coder_state->segment_index = segment_index;
+	coder_state->segment_capacity = capacity;
+	return true;
+}
+
+static void end_segment(encd_state_t *const coder_state, const uint64_t input_pos)
+{
+	if (coder_state->segment_index && input_pos)
+	{
+		mpatch_crc32_final(&coder_state->segment_crc, coder_state->segment_index[(input_pos - 1U) / coder_state->segment_size].crc32);
+	}
+}
+
+static bool begin_segment(const input_window_t *const input, const uint64_t input_pos, const mpatch_writer_t *const output, encd_state_t *const coder_state, thread_pool_t *const thread_pool)
+{
+	//Complete the previous segment at a byte boundary
+	if (input_pos)
+	{
+		if (!flush_chunks(input, output, coder_state, thread_pool))
+		{
+			return false;
+		}
+		align_output(&coder_state->output_state);
+		end_segment(coder_state, input_pos);
+	}
+
+	//Add the new segment to the index, the CRC-32 is computed as the chunks are encoded
+	coder_state->segment_end = segment_end(input_pos, coder_state->segment_size, input->length);
+	if (coder_state->segment_index)
+	{
+		const uint64_t segment_idx = input_pos / coder_state->segment_size;
+		if ((segment_idx >= coder_state->segment_capacity) && (!_grow_segment_index(coder_state, segment_idx)))
+		{
+			return false;
+		}
+		segment_entry_t *const entry = &coder_state->segment_index[segment_idx];
+		enc_uint64(entry->output_offset, input_pos);
+		enc_uint64(entry->patch_offset, output_stream_position(&coder_state->output_state));
+		mpatch_crc32_init(&coder_state->segment_crc);
+	}
+
+	coder_state->prev_offset = 0U;
+	return true;
+}
+
+static bool write_segment_index(const input_window_t *const input, const mpatch_writer_t *const output, encd_state_t *const coder_state)
+{
+	if (coder_state->segment_index)
+	{
+		align_output(&coder_state->output_state);
+		return write_bytes((const uint8_t*)coder_state->segment_index, ((uint64_t)segment_count(input->length, coder_state->segment_size)) * sizeof(segment_entry_t), output, &coder_state->output_state);
+	}
+	return true;
+}
+
+static bool _segment_writer(const uint8_t *const data, const uint32_t size, const uintptr_t user_data)
+{
+	segment_job_t *const job = (segment_job_t*)user_data;
+	if (size > job->capacity - job->length)
+	{
+		const uint64_t capacity = (job->length + size > 2U * job->capacity) ? (job->length + size) : (2U * job->capacity);
+		uint8_t *const buffer = (capacity <= SIZE_MAX) ? (uint8_t*)realloc(job->data, (size_t)capacity * sizeof(uint8_t)) : NULL;
+		if (!buffer)
+		{
+			return false;
+		}
+		job->data = buffer;
+		job->capacity = capacity;
+	}
+	memcpy(job->data + job->length, data, size);
+	job->length += size;
+	return true;
+}
+
+static void encode_segment(const uintptr_t user_data)
+{
+	segment_job_t *const job = (segment_job_t*)user_data;
+	encd_state_t *const coder_state = job->coder_state;
+	const mpatch_writer_t output = { _segment_writer, (uintptr_t)job };
+	mpatch_logger_t logger;
+	memset(&logger, 0, sizeof(mpatch_logger_t));
+
+	job->success = false;
+	job->length = 0U;
+
+	//Start the segment with a fresh output state
+	init_io_state(&coder_state->output_state);
+	coder_state->segment_end = segment_end(job->input_pos, coder_state->segment_size, job->input->length);
+	coder_state->prev_offset = 0U;
+	mpatch_crc32_compute(input_ptr(job->input, job->input_pos), (size_t)(coder_state->segment_end - job->input_pos), job->crc32);
+
+	//Encode all chunks of the segment
+	for (uint64_t input_pos = job->input_pos; input_pos < coder_state->segment_end;)
+	{
+		if (is_cancelled(coder_state->search.cancel))
+		{
+			return;
+		}
+		const uint64_t chunk_len = encode_chunk(job->input, input_pos, job->reference_buffer, &output, coder_state, job->thread_pool, &logger);
+		if (!chunk_len)
+		{
+			return;
+		}
+		input_pos += chunk_len;
+		update_effort(coder_state, chunk_len, (coder_state->segment_end - input_pos) + job->bytes_after);
+	}
+
+	job->success = flush_chunks(job->input, &output, coder_state, NULL) && flush_state(&output, &coder_state->output_state);
+}
+
+static bool append_segment(const segment_job_t *const job, const mpatch_writer_t *const output, encd_state_t *const coder_state)
+{
+	//Add the segment to the index
+	segment_entry_t *const entry = &coder_state->segment_index[job->input_pos / coder_state->segment_size];
+	align_output(&coder_state->output_state);
+	enc_uint64(entry->output_offset, job->input_pos);
+	enc_uint64(entry->patch_offset, output_stream_position(&coder_state->output_state));
+	memcpy(entry->crc32, job->crc32, 4U);
+
+	//Append the encoded segment
+	return write_bytes(job->data, job->length, output, &coder_state->output_state);
+}
+
+static void merge_stats(encd_state_t *const coder_state, const encd_state_t *const worker_state)
+{
+	coder_state->stats.literal_bytes += worker_state->stats.literal_bytes;
+	coder_state->stats.substring_bytes += worker_state->stats.substring_bytes;
+	coder_state->stats.saved_bytes += worker_state->stats.saved_bytes;
+	for (uint_fast32_t i = 0U; i <= MAX_LITERAL_LEN; ++i)
+	{
+		coder_state->stats.literal_hist[i] += worker_state->stats.literal_hist[i];
+	}
+	for (uint_fast32_t i = 0U; i < SPLIT_BUCKETS; ++i)
+	{
+		coder_state->search.split_hist[i] += worker_state->search.split_hist[i];
+	}
+	for (uint_fast32_t i = 0U; i < EFFORT_LEVELS; ++i)
+	{
+		coder_state->stats.effort_bytes[i] += worker_state->stats.effort_bytes[i];
+	}
 }
@@ -0,0 +1,227 @@
+/* ---------------------------------------------------------------------------------------------- */
+/* MPatchLib - patch and compression library                                                      */
+/* Copyright(c) 2018 LoRd_MuldeR <mulder2@gmx.de>                                                 */
+/*                                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy of this software  */
+/* and associated documentation files (the "Software"), to deal in the Software without           */
+/* restriction, including without limitation the rights to use, copy, modify, merge, publish,     */
+/* distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the  */
+/* Software is furnished to do so, subject to the following conditions:                           */
+/*                                                                                                */
+/* The above copyright notice and this permission notice shall be included in all copies or       */
+/* substantial portions of the Software.                                                          */
+/*                                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING  */
+/* BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND     */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,   */
+/* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.        */
+/* ---------------------------------------------------------------------------------------------- */
+
+#ifndef _INC_MPATCH_FINGERPRINT_H
+#define _INC_MPATCH_FINGERPRINT_H
+
+#include "utils.h"
+
+#include <stdlib.h>
+
+#define FP_LENGTH 32U
+#define FP_MIN_STRIDE 64U
+#define FP_HIT_WINDOW 4096U
+
+/*
+ * References that are too large to be scanned for every chunk are searched in windows, guided by a coarse fingerprint
+ * index: the reference is sampled every "stride" bytes, and the position of each sample is stored in an open-addressed
+ * table (linear probing, at most half full), keyed by the hash of the FP_LENGTH bytes at that position. A match of at
+ * least "stride + FP_LENGTH - 1" bytes covers one of the samples, so it is found by hashing the needle at its first
+ * "stride" offsets (using a rolling hash). The table stores no hashes, instead every candidate is verified against the
+ * reference, so a colliding sample neither displaces another one nor yields a window. Samples whose bytes repeat an
+ * earlier sample are not stored, so a match that only covers such a sample leads to the earlier one instead.
+ * The reference is then searched at full resolution only in an anchored window around the previous offset, and in a
+ * window of FP_HIT_WINDOW bytes around each sample that the needle matches. Half of the budget is spent on the table,
+ * which determines the stride, the other half limits the windows that are searched per chunk; once that limit is hit,
+ * the later offsets of the needle are not probed. An index without the anchored window ("hash-only") spends that part
+ * of the budget on further fingerprint windows instead.
+ */
+
+static const uint64_t FP_BASE = 0x100000001B3ULL;
+
+typedef struct
+{
+	uint64_t begin;
+	uint64_t end;
+}
+fp_range_t;
+
+typedef struct
+{
+	const uint8_t *reference; /*must outlive the index, the samples are verified against it*/
+	uint64_t *slots; /*position plus one, or zero*/
+	uint_fast32_t slot_bits;
+	uint64_t stride;
+	uint64_t roll_factor;
+	uint64_t anchor_window;
+	uint_fast32_t max_ranges;
+}
+fp_index_t;
+
+static __forceinline uint64_t _fp_hash(const uint8_t *const data)
+{
+	uint64_t hash = 0U;
+	for (uint_fast32_t i = 0U; i < FP_LENGTH; ++i)
+	{
+		hash = (hash * FP_BASE) + data[i];
+	}
+	return hash;
+}
+
+static __forceinline size_t _fp_slot(const fp_index_t *const index, const uint64_t hash)
+{
+	return (size_t)((hash * 0x9E3779B97F4A7C15ULL) >> (64U - index->slot_bits));
+}
+
+static __forceinline bool _fp_equal(const fp_index_t *const index, const uint64_t slot, const uint8_t *const data)
+{
+	return !memcmp(index->reference + (slot - 1U), data, FP_LENGTH);
+}
+
+static inline bool fp_index_init(fp_index_t *const index, const uint8_t *const reference, const uint64_t reference_len, const uint64_t budget, const bool anchored, const cancel_token_t *const cancel)
+{
+	memset(index, 0, sizeof(fp_index_t));
+	index->reference = reference;
+
+	//Size the table, but do not use more slots than twice the number of samples at the minimum stride
+	const uint64_t max_slots = min_uint64((budget / 2U) / sizeof(uint64_t), 2U * ((reference_len / FP_MIN_STRIDE) + 1U));
+	index->slot_bits = bit_length_uint64(max_slots) - 1U;
+	const uint64_t slot_count = ((uint64_t)1U) << index->slot_bits;
+	if (slot_count > SIZE_MAX / sizeof(uint64_t))
+	{
+		return false;
+	}
+
+	//Choose the stride, so that the samples fill at most half of the slots
+	for (index->stride = FP_MIN_STRIDE; (reference_len / index->stride) > (slot_count / 2U); index->stride <<= 1U);
+	index->roll_factor = 1U;
+	for (uint_fast32_t i = 1U; i < FP_LENGTH; ++i)
+	{
+		index->roll_factor *= FP_BASE;
+	}
+
+	//Split the window budget between the anchored window and the fingerprint windows
+	index->anchor_window = anchored ? (budget / 4U) : 0U;
+	index->max_ranges = (uint_fast32_t)min_uint64(((budget / 2U) - index->anchor_window) / FP_HIT_WINDOW, index->stride) + 1U;
+
+	//Sample the reference, the table is at most half full, so probing always ends at an empty slot
+	if (!(index->slots = (uint64_t*)calloc((size_t)slot_count, sizeof(uint64_t))))
+	{
+		return false;
+	}
+	const size_t slot_mask = (size_t)(slot_count - 1U);
+	for (uint64_t pos = 0U, next_poll = CANCEL_POLL_SIZE; pos + FP_LENGTH <= reference_len; pos += index->stride)
+	{
+		if (pos >= next_poll)
+		{
+			if (is_cancelled(cancel))
+			{
+				return false;
+			}
+			next_poll = pos + CANCEL_POLL_SIZE;
+		}
+		size_t s = _fp_slot(index, _fp_hash(reference + pos));
+		while (index->slots[s] && (!_fp_equal(index, index->slots[s], reference + pos)))
+		{
+			s = (s + 1U) & slot_mask;
+		}
+		if (!index->slots[s])
+		{
+			index->slots[s] = pos + 1U; /*otherwise, an earlier sample has the same bytes*/
+		}
+	}
+
+	return true;
+}
+
+static inline uint64_t fp_index_memory(const fp_index_t *const index)
+{
+	return index->slots ? ((((uint64_t)1U) << index->slot_bits) * sizeof(uint64_t)) : 0U;
+}
+
+static inline void fp_index_free(fp_index_t *const index)
+{
+	if (index->slots)
+	{
+		free(index->slots);
+	}
+	memset(index, 0, sizeof(fp_index_t));
+}
+
+static __forceinline void _fp_add_range(fp_range_t *const ranges, uint_fast32_t *const count, const uint64_t center, const uint64_t size, const uint64_t haystack_begin, const uint64_t haystack_len)
+{
+	const uint64_t begin = (center > haystack_begin + (size / 2U)) ? (center - (size / 2U)) : haystack_begin;
+	const uint64_t end = (begin < haystack_len) ? min_uint64(begin + size, haystack_len) : begin;
+	if (begin < end)
+	{
+		ranges[*count].begin = begin;
+		ranges[(*count)++].end = end;
+	}
+}
+
+static int _fp_compare_ranges(const void *const a, const void *const b)
+{
+	const uint64_t begin_a = ((const fp_range_t*)a)->begin, begin_b = ((const fp_range_t*)b)->begin;
+	return (begin_a > begin_b) - (begin_a < begin_b);
+}
+
+static inline uint_fast32_t fp_select_ranges(const fp_index_t *const index, fp_range_t *const ranges, const uint8_t *const needle, const uint64_t needle_len, const uint64_t prev_offset, const uint64_t haystack_begin, const uint64_t haystack_len)
+{
+	//Anchored window around the previous offset
+	uint_fast32_t count = 0U;
+	_fp_add_range(ranges, &count, prev_offset, index->anchor_window, haystack_begin, haystack_len);
+
+	//Windows around the positions that the fingerprints of the needle point to
+	if (needle_len >= FP_LENGTH)
+	{
+		const uint64_t probe_count = min_uint64(index->stride, needle_len - FP_LENGTH + 1U);
+		const size_t slot_mask = (((size_t)1U) << index->slot_bits) - 1U;
+		uint64_t hash = _fp_hash(needle);
+		for (uint64_t j = 0U; (j < probe_count) && (count < index->max_ranges); ++j)
+		{
+			if (j)
+			{
+				hash = ((hash - (needle[j - 1U] * index->roll_factor)) * FP_BASE) + needle[j + FP_LENGTH - 1U];
+			}
+			for (size_t s = _fp_slot(index, hash); index->slots[s]; s = (s + 1U) & slot_mask)
+			{
+				const uint64_t slot = index->slots[s];
+				if ((slot > j) && _fp_equal(index, slot, needle + j))
+				{
+					_fp_add_range(ranges, &count, (slot - 1U) - j, FP_HIT_WINDOW, haystack_begin, haystack_len);
+					break; /*samples are unique*/
+				}
+			}
+		}
+	}
+
+	//Sort and merge the ranges
+	if (count > 1U)
+	{
+		qsort(ranges, count, sizeof(fp_range_t), _fp_compare_ranges);
+		uint_fast32_t merged = 0U;
+		for (uint_fast32_t i = 1U; i < count; ++i)
+		{
+			if (ranges[i].begin <= ranges[merged].end)
+			{
+				ranges[merged].end = (ranges[i].end > ranges[merged].end) ? ranges[i].end : ranges[merged].end;
+			}
+			else
+			{
+				ranges[++merged] = ranges[i];
+			}
+		}
+		count = merged + 1U;
+	}
+
+	return count;
+}
+
+#endif /*_INC_MPATCH_FINGERPRINT_H*/
@@ -18,178 +18,676 @@
 /* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.        */
 /* ---------------------------------------------------------------------------------------------- */
 
+#if defined(__linux__) && (!defined(_GNU_SOURCE))
+#define _GNU_SOURCE /*for pthread_setaffinity_np()*/
+#endif
+
 #include "pool.h"
+#include "utils.h"
 
 #ifdef _MSC_VER
 #define HAVE_STRUCT_TIMESPEC
+#include <intrin.h>
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN 1
+#include <Windows.h>
+#else
+#include <time.h>
 #endif
 
 #include <pthread.h>
-#include <semaphore.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 
 #include <stdlib.h>
 #include <malloc.h>
 #include <memory.h>
+#include <limits.h>
+
+#define DEQUE_SIZE 256U
+#define SPIN_MIN 64U
+#define SPIN_MAX 16384U
+#define CALIBRATION_ROUNDS 64U
+
+/*
+ * Each worker thread owns a deque of tasks. A thread that submits tasks pushes them to the bottom of its own deque (or,
+ * if it is not a worker of the pool, to the bottom of the shared deque for external threads), while idle threads steal
+ * tasks from the top of any other deque. Tasks are claimed by an atomic compare-and-swap, so no lock is held while the
+ * tasks are distributed. The submitting thread executes tasks itself until all of its tasks are done, so tasks may in
+ * turn submit tasks to the same pool; if the deque fills up, it executes queued tasks until there is space again.
+ * Threads that find no task sleep until the next "event", i.e. the submission of new tasks or the completion of a batch
+ * of tasks. Before going to sleep, a thread spins for a while, because the next event usually follows shortly in
+ * fork-join workloads; the spin limit adapts to how often spinning actually paid off.
+ * When the pool is created, the round-trip time of an empty fork-join is measured, so that callers can decide whether
+ * splitting a piece of work is worth the dispatch cost.
+ *
+ * Optionally, the worker threads are pinned to processors, in the order in which they appear in the affinity mask of the
+ * process. Then mpatch_pool_exec_affine() assigns each task to a certain worker, by pushing it to that worker's "inbox"
+ * (the owner side of which is guarded by a spin lock, as there can be many submitting threads). Tasks touching the same
+ * part of memory thus run on the same processor, and on the NUMA node where that memory was first touched. The submitting
+ * thread is not pinned, so it gets no tasks assigned. An inbox may still be robbed by idle threads (including the
+ * submitting thread), so that the load remains balanced.
+ */
+
+/* ======================================================================= */
+/* Atomic operations                                                       */
+/* ======================================================================= */
+
+#ifdef _MSC_VER
+static __forceinline uint32_t atomic_load_u32(const volatile uint32_t *const ptr)
+{
+	const uint32_t value = *ptr; /*x86/x64 loads are not reordered with other loads*/
+	_ReadWriteBarrier();
+	return value;
+}
+static __forceinline void atomic_store_u32(volatile uint32_t *const ptr, const uint32_t value)
+{
+	_InterlockedExchange((volatile long*)ptr, (long)value);
+}
+static __forceinline uint32_t atomic_add_u32(volatile uint32_t *const ptr, const uint32_t value)
+{
+	return ((uint32_t)_InterlockedExchangeAdd((volatile long*)ptr, (long)value)) + value;
+}
+static __forceinline bool atomic_cas_u32(volatile uint32_t *const ptr, const uint32_t expected, const uint32_t desired)
+{
+	return (((uint32_t)_InterlockedCompareExchange((volatile long*)ptr, (long)desired, (long)expected)) == expected);
+}
+#else
+static __forceinline uint32_t atomic_load_u32(const volatile uint32_t *const ptr)
+{
+	return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
+static __forceinline void atomic_store_u32(volatile uint32_t *const ptr, const uint32_t value)
+{
+	__atomic_store_n(ptr, value, __ATOMIC_SEQ_CST);
+}
+static __forceinline uint32_t atomic_add_u32(volatile uint32_t *const ptr, const uint32_t value)
+{
+	return __atomic_add_fetch(ptr, value, __ATOMIC_SEQ_CST);
+}
+static __forceinline bool atomic_cas_u32(volatile uint32_t *const ptr, uint32_t expected, const uint32_t desired)
+{
+	return __atomic_compare_exchange_n(ptr, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+#endif
+
+/*slots may be overwritten while a thief still reads them (its CAS will fail then), so access them atomically*/
+#ifdef _MSC_VER
+#define ATOMIC_LOAD_PTR(X) (X)
+#define ATOMIC_STORE_PTR(X, Y) ((X) = (Y))
+#else
+#define ATOMIC_LOAD_PTR(X) __atomic_load_n(&(X), __ATOMIC_RELAXED)
+#define ATOMIC_STORE_PTR(X, Y) __atomic_store_n(&(X), (Y), __ATOMIC_RELAXED)
+#endif
+
+#if defined(_MSC_VER)
+#define CPU_RELAX() _mm_pause()
+#elif defined(__i386__) || defined(__x86_64__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#else
+#define CPU_RELAX() ((void)0)
+#endif
 
 /* ======================================================================= */
 /* Types                                                                   */
 /* ======================================================================= */
 
 typedef struct
+{
+	volatile uint32_t remaining;
+}
+pool_batch_t;
+
+typedef struct
+{
+	const pool_task_t *task;
+	pool_batch_t *batch;
+}
+pool_slot_t;
+
+typedef struct
+{
+	const pool_task_t *volatile task;
+	pool_batch_t *volatile batch;
+}
+pool_shared_slot_t;
+
+typedef struct CACHE_ALIGN
+{
+	volatile uint32_t top; /*modified by thieves*/
+	uint8_t padding[CACHE_LINE - sizeof(uint32_t)];
+	volatile uint32_t bottom; /*modified by the owner*/
+	pool_shared_slot_t slots[DEQUE_SIZE];
+}
+pool_deque_t;
+
+typedef struct CACHE_ALIGN
+{
+	pool_deque_t deque;
+	pool_deque_t inbox;
+	volatile uint32_t inbox_lock;
+	pthread_t thread;
+}
+pool_worker_t;
+
+typedef struct CACHE_ALIGN
 {
 	thread_pool_t pool;
-	pthread_t threads[MAX_THREAD_COUNT];
-	pthread_mutex_t mutex;
-	pthread_cond_t cond_complete;
-	sem_t sem_task;
-	const pool_task_t *next_task;
-	uint_fast32_t pending_tasks;
-	bool shutdown_flag;
+	volatile uint32_t worker_count;
+	pool_worker_t *workers;
+	pool_deque_t external_deque;
+	pthread_key_t deque_key;
+	pthread_mutex_t external_mutex;
+#ifndef __linux__
+	pthread_mutex_t event_mutex;
+	pthread_cond_t cond_event;
+#endif
+	volatile uint32_t event_count;
+	volatile uint32_t idle_count;
+	volatile uint32_t spin_limit;
+	volatile uint32_t shutdown_flag;
 }
 pool_private_t;
 
+typedef struct
+{
+	pool_private_t *p;
+	pool_worker_t *worker;
+}
+worker_args_t;
+
 /* ======================================================================= */
-/* Helper macros                                                           */
+/* Deque functions                                                         */
 /* ======================================================================= */
 
-#define ENTER_CRITICAL_SECTION() do \
-{ \
-	if (pthread_mutex_lock(&p->mutex)) \
-	{ \
-		abort(); \
-	} \
-} \
-while (0)
-
-#define LEAVE_CRITICAL_SECTION() do \
-{ \
-	if (pthread_mutex_unlock(&p->mutex)) \
-	{ \
-		abort(); \
-	} \
-} \
-while (0)
-
-#define AWAIT_MY_PENDING_TASKS() do \
-{ \
-	while (p->pending_tasks) \
-	{ \
-		if (pthread_cond_wait(&p->cond_complete, &p->mutex)) \
-		{ \
-			abort(); \
-		} \
-	} \
-} \
-while(0)
-
-static const pool_task_t STOP_TASKS[MAX_THREAD_COUNT];
+static bool deque_push(pool_deque_t *const deque, const pool_task_t *const task, pool_batch_t *const batch)
+{
+	const uint32_t bottom = atomic_load_u32(&deque->bottom), top = atomic_load_u32(&deque->top);
+	if ((int32_t)(bottom - top) >= (int32_t)DEQUE_SIZE)
+	{
+		return false; /*deque is full*/
+	}
+	pool_shared_slot_t *const slot = &deque->slots[bottom & (DEQUE_SIZE - 1U)];
+	ATOMIC_STORE_PTR(slot->task, task);
+	ATOMIC_STORE_PTR(slot->batch, batch);
+	atomic_store_u32(&deque->bottom, bottom + 1U);
+	return true;
+}
+
+static __forceinline uint32_t deque_space(const pool_deque_t *const deque)
+{
+	return DEQUE_SIZE - (atomic_load_u32(&deque->bottom) - atomic_load_u32(&deque->top)); /*owner side only, thieves can only make more space*/
+}
+
+static __forceinline void read_slot(pool_slot_t *const slot, const pool_shared_slot_t *const shared_slot)
+{
+	slot->task = ATOMIC_LOAD_PTR(shared_slot->task);
+	slot->batch = ATOMIC_LOAD_PTR(shared_slot->batch);
+}
+
+static bool deque_pop(pool_deque_t *const deque, pool_slot_t *const slot)
+{
+	const uint32_t bottom = atomic_load_u32(&deque->bottom) - 1U;
+	atomic_store_u32(&deque->bottom, bottom);
+	const uint32_t top = atomic_load_u32(&deque->top);
+	if ((int32_t)(bottom - top) < 0)
+	{
+		atomic_store_u32(&deque->bottom, bottom + 1U);
+		return false; /*deque is empty*/
+	}
+	read_slot(slot, &deque->slots[bottom & (DEQUE_SIZE - 1U)]);
+	if (bottom != top)
+	{
+		return true;
+	}
+	const bool success = atomic_cas_u32(&deque->top, top, top + 1U); /*last task, race against thieves*/
+	atomic_store_u32(&deque->bottom, bottom + 1U);
+	return success;
+}
+
+static bool deque_steal(pool_deque_t *const deque, pool_slot_t *const slot)
+{
+	for (;;)
+	{
+		const uint32_t top = atomic_load_u32(&deque->top);
+		const uint32_t bottom = atomic_load_u32(&deque->bottom);
+		if ((int32_t)(bottom - top) <= 0)
+		{
+			return false; /*deque is empty*/
+		}
+		read_slot(slot, &deque->slots[top & (DEQUE_SIZE - 1U)]);
+		if (atomic_cas_u32(&deque->top, top, top + 1U))
+		{
+			return true;
+		}
+	}
+}
 
 /* ======================================================================= */
-/* Thread function                                                         */
+/* Helper functions                                                        */
 /* ======================================================================= */
 
-static void *thread_func(void *const args)
+#ifdef __linux__
+static __forceinline void futex_wait(volatile uint32_t *const addr, const uint32_t value)
 {
-	pool_private_t *const p = (pool_private_t*)args;
-	if (!p)
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0); /*spurious wake-ups are fine*/
+}
+static __forceinline void futex_wake(volatile uint32_t *const addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+#endif
+
+static void signal_event(pool_private_t *const p)
+{
+	atomic_add_u32(&p->event_count, 1U);
+	if (atomic_load_u32(&p->idle_count))
+	{
+#ifdef __linux__
+		futex_wake(&p->event_count);
+#else
+		if (pthread_mutex_lock(&p->event_mutex) || pthread_cond_broadcast(&p->cond_event) || pthread_mutex_unlock(&p->event_mutex))
+		{
+			abort();
+		}
+#endif
+	}
+}
+
+static bool spin_event(pool_private_t *const p, const uint32_t event_count)
+{
+	const uint32_t spin_limit = atomic_load_u32(&p->spin_limit);
+	for (uint32_t i = 0U; i < spin_limit; ++i)
 	{
-		return NULL;
+		if ((atomic_load_u32(&p->event_count) != event_count) || atomic_load_u32(&p->shutdown_flag))
+		{
+			if (spin_limit < SPIN_MAX)
+			{
+				atomic_store_u32(&p->spin_limit, spin_limit << 1); /*spinning paid off, spin longer next time*/
+			}
+			return true;
+		}
+		CPU_RELAX();
 	}
+	if (spin_limit > SPIN_MIN)
+	{
+		atomic_store_u32(&p->spin_limit, spin_limit >> 1);
+	}
+	return false;
+}
 
-	const pool_task_t *task = NULL;
-	bool shutting_down = false, queue_drained = false;
+static void await_event(pool_private_t *const p, const uint32_t event_count)
+{
+	//Spin first, sleeping and waking up is much more expensive
+	if (spin_event(p, event_count))
+	{
+		return;
+	}
 
-	for (;;)
+	//Go to sleep until the event count changes
+#ifdef __linux__
+	atomic_add_u32(&p->idle_count, 1U);
+	while ((atomic_load_u32(&p->event_count) == event_count) && (!atomic_load_u32(&p->shutdown_flag)))
 	{
-		if (sem_wait(&p->sem_task))
+		futex_wait(&p->event_count, event_count);
+	}
+	atomic_add_u32(&p->idle_count, (uint32_t)(-1));
+#else
+	if (pthread_mutex_lock(&p->event_mutex))
+	{
+		abort();
+	}
+	atomic_add_u32(&p->idle_count, 1U);
+	while ((atomic_load_u32(&p->event_count) == event_count) && (!atomic_load_u32(&p->shutdown_flag)))
+	{
+		if (pthread_cond_wait(&p->cond_event, &p->event_mutex))
 		{
 			abort();
 		}
+	}
+	atomic_add_u32(&p->idle_count, (uint32_t)(-1));
+	if (pthread_mutex_unlock(&p->event_mutex))
+	{
+		abort();
+	}
+#endif
+}
 
-		ENTER_CRITICAL_SECTION();
-		task = p->next_task++;
-		shutting_down = p->shutdown_flag;
-		LEAVE_CRITICAL_SECTION();
+static __forceinline void lock_inbox(pool_worker_t *const worker)
+{
+	while (!atomic_cas_u32(&worker->inbox_lock, 0U, 1U))
+	{
+		CPU_RELAX();
+	}
+}
 
-		if (shutting_down)
+static __forceinline void unlock_inbox(pool_worker_t *const worker)
+{
+	atomic_store_u32(&worker->inbox_lock, 0U);
+}
+
+static bool find_task(pool_private_t *const p, pool_deque_t *const own_deque, pool_slot_t *const slot)
+{
+	//Try own deque first, then the tasks that were assigned to this thread
+	if (own_deque)
+	{
+		if (deque_pop(own_deque, slot))
+		{
+			return true;
+		}
+		pool_worker_t *const own_worker = (pool_worker_t*)own_deque; /*the deque is the first member*/
+		if (atomic_load_u32(&own_worker->inbox.bottom) != atomic_load_u32(&own_worker->inbox.top))
+		{
+			lock_inbox(own_worker);
+			const bool success = deque_pop(&own_worker->inbox, slot);
+			unlock_inbox(own_worker);
+			if (success)
+			{
+				return true;
+			}
+		}
+	}
+	else
+	{
+		bool success;
+		if (pthread_mutex_lock(&p->external_mutex))
 		{
-			return p; /*shuttong down!*/
+			abort();
 		}
+		success = deque_pop(&p->external_deque, slot);
+		if (pthread_mutex_unlock(&p->external_mutex))
+		{
+			abort();
+		}
+		if (success)
+		{
+			return true;
+		}
+	}
 
-		if (task->func)
+	//Steal from the other deques (the last one is the external deque)
+	const uint32_t deque_count = atomic_load_u32(&p->worker_count) + 1U;
+	const uint32_t first = own_deque ? ((uint32_t)(((pool_worker_t*)own_deque) - p->workers) + 1U) : 0U;
+	for (uint32_t i = 0U; i < deque_count; ++i)
+	{
+		const uint32_t index = (first + i) % deque_count;
+		pool_deque_t *const deque = (index < deque_count - 1U) ? &p->workers[index].deque : &p->external_deque;
+		if ((deque != own_deque) && deque_steal(deque, slot))
+		{
+			return true;
+		}
+		if ((index < deque_count - 1U) && deque_steal(&p->workers[index].inbox, slot))
 		{
-			task->func(task->data);
+			return true;
 		}
+	}
+
+	return false;
+}
+
+static void run_task(pool_private_t *const p, const pool_slot_t *const slot)
+{
+	if (slot->task->func)
+	{
+		slot->task->func(slot->task->data);
+	}
+	if (!atomic_add_u32(&slot->batch->remaining, (uint32_t)(-1)))
+	{
+		signal_event(p); /*batch complete*/
+	}
+}
+
+static void help_once(pool_private_t *const p, pool_deque_t *const own_deque)
+{
+	pool_slot_t slot;
+	if (find_task(p, own_deque, &slot))
+	{
+		run_task(p, &slot);
+	}
+	else
+	{
+		CPU_RELAX(); /*a thief has just made space*/
+	}
+}
+
+/* ======================================================================= */
+/* Thread affinity                                                         */
+/* ======================================================================= */
 
-		ENTER_CRITICAL_SECTION();
-		queue_drained = (!(--p->pending_tasks));
-		LEAVE_CRITICAL_SECTION();
+#ifdef _WIN32
+typedef struct
+{
+	ULONG_PTR mask;
+	WORD group;
+	WORD reserved[3U];
+}
+group_affinity_t;
+typedef WORD(WINAPI *GET_ACTIVE_GROUPCOUNT)(void);
+typedef DWORD(WINAPI *GET_ACTIVE_PROCCOUNT)(WORD);
+typedef BOOL(WINAPI *SET_THREAD_GROUPAFFINITY)(HANDLE, const group_affinity_t*, group_affinity_t*);
+#endif
 
-		if (queue_drained)
+static void pin_thread(uint32_t processor)
+{
+#if defined(_WIN32)
+	const HMODULE kernel32 = GetModuleHandleW(L"kernel32");
+	const GET_ACTIVE_GROUPCOUNT get_active_groupcount = kernel32 ? (GET_ACTIVE_GROUPCOUNT)GetProcAddress(kernel32, "GetActiveProcessorGroupCount") : NULL;
+	const GET_ACTIVE_PROCCOUNT get_active_proccount = kernel32 ? (GET_ACTIVE_PROCCOUNT)GetProcAddress(kernel32, "GetActiveProcessorCount") : NULL;
+	const SET_THREAD_GROUPAFFINITY set_thread_groupaffinity = kernel32 ? (SET_THREAD_GROUPAFFINITY)GetProcAddress(kernel32, "SetThreadGroupAffinity") : NULL;
+	if (get_active_groupcount && get_active_proccount && set_thread_groupaffinity)
+	{
+		const DWORD total = get_active_proccount(0xFFFF); /*ALL_PROCESSOR_GROUPS*/
+		processor = total ? (processor % total) : 0U;
+		const WORD group_count = get_active_groupcount();
+		for (WORD group = 0U; group < group_count; ++group)
 		{
-			if (pthread_cond_broadcast(&p->cond_complete))
+			const DWORD count = get_active_proccount(group);
+			if (processor < count)
 			{
-				abort();
+				group_affinity_t affinity;
+				memset(&affinity, 0, sizeof(group_affinity_t));
+				affinity.mask = ((ULONG_PTR)1U) << processor;
+				affinity.group = group;
+				set_thread_groupaffinity(GetCurrentThread(), &affinity, NULL);
+				return;
 			}
+			processor -= count;
 		}
 	}
+	else
+	{
+		SYSTEM_INFO system_info;
+		GetSystemInfo(&system_info);
+		processor = system_info.dwNumberOfProcessors ? (processor % system_info.dwNumberOfProcessors) : 0U;
+		SetThreadAffinityMask(GetCurrentThread(), ((DWORD_PTR)1U) << processor);
+	}
+#elif defined(__linux__)
+	cpu_set_t allowed, cpu_set;
+	if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) || (CPU_COUNT(&allowed) < 1))
+	{
+		return; /*failure is not fatal*/
+	}
+	processor %= (uint32_t)CPU_COUNT(&allowed); /*the n-th processor that we may run on, e.g. within a "numactl" binding*/
+	for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+	{
+		if (CPU_ISSET(cpu, &allowed) && (!(processor--)))
+		{
+			CPU_ZERO(&cpu_set);
+			CPU_SET(cpu, &cpu_set);
+			pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpu_set); /*failure is not fatal*/
+			return;
+		}
+	}
+#else
+	(void)processor; /*not supported*/
+#endif
+}
+
+/* ======================================================================= */
+/* Thread function                                                         */
+/* ======================================================================= */
+
+static void *thread_func(void *const args)
+{
+	pool_private_t *const p = ((worker_args_t*)args)->p;
+	pool_worker_t *const own_worker = ((worker_args_t*)args)->worker;
+	pool_deque_t *const own_deque = &own_worker->deque;
+	free(args);
+
+	if (p->pool.pinned)
+	{
+		pin_thread((uint32_t)(own_worker - p->workers));
+	}
+
+	if (pthread_setspecific(p->deque_key, own_deque))
+	{
+		abort();
+	}
+
+	for (;;)
+	{
+		pool_slot_t slot;
+		const uint32_t event_count = atomic_load_u32(&p->event_count);
+		if (find_task(p, own_deque, &slot))
+		{
+			run_task(p, &slot);
+			continue;
+		}
+		if (atomic_load_u32(&p->shutdown_flag))
+		{
+			return p; /*shutting down!*/
+		}
+		await_event(p, event_count);
+	}
+}
+
+/* ======================================================================= */
+/* Calibration                                                             */
+/* ======================================================================= */
+
+static uint32_t measure_dispatch(thread_pool_t *const pool, const pool_task_t *const tasks, const uint32_t count)
+{
+	mpatch_pool_exec(pool, tasks, count); /*warm-up*/
+	const uint64_t time_begin = mpatch_pool_clock();
+	for (uint32_t i = 0U; i < CALIBRATION_ROUNDS; ++i)
+	{
+		mpatch_pool_exec(pool, tasks, count);
+	}
+	const uint64_t elapsed = (mpatch_pool_clock() - time_begin) / CALIBRATION_ROUNDS;
+	return (elapsed < UINT32_MAX) ? (uint32_t)elapsed : UINT32_MAX;
+}
+
+static void calibrate_dispatch(pool_private_t *const p)
+{
+	const uint32_t thread_count = p->pool.thread_count;
+	pool_task_t *const tasks = (pool_task_t*)calloc(thread_count, sizeof(pool_task_t)); /*no function, i.e. empty tasks*/
+	if (!tasks)
+	{
+		p->pool.dispatch_base = p->pool.dispatch_step = UINT32_MAX; /*never split*/
+		return;
+	}
+	p->pool.dispatch_base = measure_dispatch(&p->pool, tasks, 2U);
+	if (thread_count > 2U)
+	{
+		const uint32_t dispatch_full = measure_dispatch(&p->pool, tasks, thread_count);
+		p->pool.dispatch_step = (dispatch_full > p->pool.dispatch_base) ? ((dispatch_full - p->pool.dispatch_base) / (thread_count - 2U)) : 0U;
+	}
+	free(tasks);
 }
 
 /* ======================================================================= */
 /* Pool functions                                                          */
 /* ======================================================================= */
 
-bool mpatch_pool_create(thread_pool_t **const pool, const uint32_t thread_count)
+bool mpatch_pool_create(thread_pool_t **const pool, const uint32_t thread_count, const bool pin_threads)
 {
-	if ((!pool) || (thread_count > MAX_THREAD_COUNT))
+	if ((!pool) || (thread_count < 1U) || (thread_count > INT_MAX))
 	{
 		return false;
 	}
 
 	*pool = NULL;
 
-	pool_private_t *const p = (pool_private_t*) calloc(1U, sizeof(pool_private_t));
+	pool_private_t *const p = (pool_private_t*) calloc_aligned(1U, sizeof(pool_private_t));
 	if (!p)
 	{
 		return false;
 	}
 
-	if (pthread_mutex_init(&p->mutex, NULL))
+	p->pool.pinned = pin_threads;
+	if ((thread_count > 1U) && (!(p->workers = (pool_worker_t*)calloc_aligned(thread_count - 1U, sizeof(pool_worker_t)))))
+	{
+		free_aligned(p);
+		return false;
+	}
+
+	if (pthread_key_create(&p->deque_key, NULL))
+	{
+		free_aligned(p->workers);
+		free_aligned(p);
+		return false;
+	}
+
+	if (pthread_mutex_init(&p->external_mutex, NULL))
 	{
-		free(p);
+		pthread_key_delete(p->deque_key);
+		free_aligned(p->workers);
+		free_aligned(p);
 		return false;
 	}
 
-	if (pthread_cond_init(&p->cond_complete, NULL))
+#ifndef __linux__
+	if (pthread_mutex_init(&p->event_mutex, NULL))
 	{
-		pthread_mutex_destroy(&p->mutex);
-		free(p);
+		pthread_mutex_destroy(&p->external_mutex);
+		pthread_key_delete(p->deque_key);
+		free_aligned(p->workers);
+		free_aligned(p);
 		return false;
 	}
 
-	if (sem_init(&p->sem_task, 0, 0))
+	if (pthread_cond_init(&p->cond_event, NULL))
 	{
-		pthread_cond_destroy(&p->cond_complete);
-		pthread_mutex_destroy(&p->mutex);
-		free(p);
+		pthread_mutex_destroy(&p->event_mutex);
+		pthread_mutex_destroy(&p->external_mutex);
+		pthread_key_delete(p->deque_key);
+		free_aligned(p->workers);
+		free_aligned(p);
 		return false;
 	}
-	
-	for (uint_fast32_t t = 0; t < thread_count; ++t)
+#endif
+
+	p->spin_limit = SPIN_MIN;
+
+	//The calling thread is one of the "thread_count" threads, so one less worker is required
+	for (uint32_t t = 0U; t < thread_count - 1U; ++t)
 	{
-		if (!pthread_create(p->threads + t, NULL, thread_func, p))
+		worker_args_t *const args = (worker_args_t*)malloc(sizeof(worker_args_t));
+		if (!args)
 		{
-			p->pool.thread_count++;
+			break;
 		}
+		args->p = p;
+		args->worker = &p->workers[p->worker_count];
+		if (pthread_create(&args->worker->thread, NULL, thread_func, args))
+		{
+			free(args);
+			break;
+		}
+		atomic_add_u32(&p->worker_count, 1U);
 	}
 
-	if (!p->pool.thread_count)
+	p->pool.thread_count = p->worker_count + 1U;
+	if (p->pool.thread_count > 1U)
 	{
-		sem_destroy(&p->sem_task);
-		pthread_cond_destroy(&p->cond_complete);
-		pthread_mutex_destroy(&p->mutex);
-		free(p);
-		return false;
+		calibrate_dispatch(p);
 	}
 
 	*pool = (thread_pool_t*)p;
@@ -206,54 +704,61 @@ bool mpatch_pool_destroy(thread_pool_t **const pool)
 	pool_private_t *const p = (pool_private_t*)(*pool);
 	*pool = NULL;
 
-	ENTER_CRITICAL_SECTION();
-	AWAIT_MY_PENDING_TASKS();
-
-	p->next_task = STOP_TASKS;
-	p->pending_tasks += MAX_THREAD_COUNT;
-	p->shutdown_flag = true;
-
-	LEAVE_CRITICAL_SECTION();
-
-	if (sem_post_multiple(&p->sem_task, MAX_THREAD_COUNT))
-	{
-		abort();
-	}
+	atomic_store_u32(&p->shutdown_flag, 1U);
+	signal_event(p);
 
 	bool success = true;
-	for (uint_fast32_t t = 0; t < MAX_THREAD_COUNT; ++t)
+	for (uint32_t t = 0U; t < p->worker_count; ++t)
 	{
-		pthread_t *const thread = p->threads + t;
-		if (thread->p)
+		if (pthread_join(p->workers[t].thread, NULL))
 		{
-			if (pthread_join(*thread, NULL))
-			{
-				success = false;
-			}
+			success = false;
 		}
 	}
 
-	if (sem_destroy(&p->sem_task))
+#ifndef __linux__
+	if (pthread_cond_destroy(&p->cond_event) || pthread_mutex_destroy(&p->event_mutex))
 	{
 		success = false;
 	}
+#endif
 
-	if (pthread_cond_destroy(&p->cond_complete))
+	if (pthread_mutex_destroy(&p->external_mutex))
 	{
 		success = false;
 	}
 
-	if (pthread_mutex_destroy(&p->mutex))
+	if (pthread_key_delete(p->deque_key))
 	{
 		success = false;
 	}
 
+	free_aligned(p->workers);
 	memset(p, 0U, sizeof(pool_private_t));
-	free(p);
+	free_aligned(p);
 
 	return success;
 }
 
+static void help_until_done(pool_private_t *const p, pool_deque_t *const own_deque, pool_batch_t *const batch)
+{
+	for (;;)
+	{
+		pool_slot_t slot;
+		const uint32_t event_count = atomic_load_u32(&p->event_count);
+		if (!atomic_load_u32(&batch->remaining))
+		{
+			return;
+		}
+		if (find_task(p, own_deque, &slot))
+		{
+			run_task(p, &slot);
+			continue;
+		}
+		await_event(p, event_count);
+	}
+}
+
 void mpatch_pool_exec(thread_pool_t *const pool, const pool_task_t *const tasks, const uint32_t count)
 {
 	pool_private_t *const p = (pool_private_t*)pool;
@@ -263,17 +768,105 @@ void mpatch_pool_exec(thread_pool_t *const pool, const pool_task_t *const tasks,
 		abort();
 	}
 
-	ENTER_CRITICAL_SECTION();
-	AWAIT_MY_PENDING_TASKS();
+	pool_batch_t batch;
+	atomic_store_u32(&batch.remaining, count);
 
-	p->next_task = tasks;
-	p->pending_tasks += count;
+	//Push the tasks in chunks that fit into the deque, each in reverse order, so that the submitting thread pops them in
+	//order; while the deque is full, help out with the queued tasks (running the rest directly would serialize them)
+	pool_deque_t *const own_deque = (pool_deque_t*)pthread_getspecific(p->deque_key);
+	pool_deque_t *const deque = own_deque ? own_deque : &p->external_deque;
+	for (uint32_t pushed = 0U; pushed < count;)
+	{
+		if ((!own_deque) && pthread_mutex_lock(&p->external_mutex))
+		{
+			abort();
+		}
+		const uint32_t chunk = (uint32_t)min_uint32(count - pushed, deque_space(deque));
+		for (uint32_t i = chunk; i > 0U; --i)
+		{
+			if (!deque_push(deque, &tasks[pushed + i - 1U], &batch))
+			{
+				abort(); /*only the owner side pushes, so the space can only have grown*/
+			}
+		}
+		if ((!own_deque) && pthread_mutex_unlock(&p->external_mutex))
+		{
+			abort();
+		}
+		if (chunk)
+		{
+			pushed += chunk;
+			signal_event(p);
+		}
+		if (pushed < count)
+		{
+			help_once(p, own_deque);
+		}
+	}
 
-	if (sem_post_multiple(&p->sem_task, count))
+	//Help out until all tasks of the batch are done
+	help_until_done(p, own_deque, &batch);
+}
+
+void mpatch_pool_exec_affine(thread_pool_t *const pool, const pool_task_t *const tasks, const uint32_t count)
+{
+	pool_private_t *const p = (pool_private_t*)pool;
+
+	if ((!p) || (!tasks) || (count > INT_MAX))
 	{
 		abort();
 	}
 
-	AWAIT_MY_PENDING_TASKS();
-	LEAVE_CRITICAL_SECTION();
+	const uint32_t worker_count = atomic_load_u32(&p->worker_count);
+	if ((!worker_count) || (!count))
+	{
+		mpatch_pool_exec(pool, tasks, count);
+		return;
+	}
+
+	pool_batch_t batch;
+	atomic_store_u32(&batch.remaining, count);
+
+	//Push each task to the inbox of the worker it belongs to (the caller is not pinned, it only helps out)
+	pool_deque_t *const own_deque = (pool_deque_t*)pthread_getspecific(p->deque_key);
+	for (uint32_t i = 0U; i < count; ++i)
+	{
+		pool_worker_t *const worker = &p->workers[((uint64_t)i * worker_count) / count];
+		for (;;)
+		{
+			lock_inbox(worker);
+			const bool success = deque_push(&worker->inbox, &tasks[i], &batch);
+			unlock_inbox(worker);
+			if (success)
+			{
+				break;
+			}
+			signal_event(p); /*inbox is full, help out until there is space*/
+			help_once(p, own_deque);
+		}
+	}
+	signal_event(p);
+
+	//Help out until all tasks of the batch are done
+	help_until_done(p, own_deque, &batch);
+}
+
+uint64_t mpatch_pool_clock(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER counter, frequency;
+	if (!(QueryPerformanceCounter(&counter) && QueryPerformanceFrequency(&frequency)))
+	{
+		abort();
+	}
+	const uint64_t ticks = (uint64_t)counter.QuadPart, rate = (uint64_t)frequency.QuadPart;
+	return ((ticks / rate) * 1000000000ULL) + (((ticks % rate) * 1000000000ULL) / rate);
+#else
+	struct timespec now;
+	if (clock_gettime(CLOCK_MONOTONIC, &now))
+	{
+		abort();
+	}
+	return ((uint64_t)now.tv_sec * 1000000000ULL) + (uint64_t)now.tv_nsec;
+#endif
 }
@@ -24,13 +24,14 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-#define MAX_THREAD_COUNT 16U
-
 typedef void (*pool_task_func_t)(const uintptr_t user_data);
 
 typedef struct
 {
-	uint32_t thread_count;
+	uint32_t thread_count; /*including the calling thread*/
+	uint32_t dispatch_base; /*measured round-trip of an empty fork-join with 2 tasks, in nanoseconds*/
+	uint32_t dispatch_step; /*measured extra round-trip time per additional task, in nanoseconds*/
+	bool pinned; /*worker "i" is pinned to the "i"-th logical processor that the process may run on*/
 }
 thread_pool_t;
 
@@ -41,8 +42,10 @@ typedef struct
 }
 pool_task_t;
 
-bool mpatch_pool_create(thread_pool_t **const pool, const uint32_t thread_count);
+bool mpatch_pool_create(thread_pool_t **const pool, const uint32_t thread_count, const bool pin_threads);
 void mpatch_pool_exec(thread_pool_t *const pool, const pool_task_t *const tasks, const uint32_t count);
+void mpatch_pool_exec_affine(thread_pool_t *const pool, const pool_task_t *const tasks, const uint32_t count); /*task "i" of "n" prefers worker "i * (thread_count - 1) / n", the caller only helps out*/
 bool mpatch_pool_destroy(thread_pool_t **const pool);
+uint64_t mpatch_pool_clock(void);
 
 #endif /*_INC_MPATCH_POOL_H*/
@@ -18,10 +18,11 @@
 #define _INC_RHASH_CRC32_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 void mpatch_crc32_init(uint32_t *const crc32);
-void mpatch_crc32_update(uint32_t *const crc32, const uint8_t *const msg, const uint_fast32_t size);
+void mpatch_crc32_update(uint32_t *const crc32, const uint8_t *const msg, const size_t size);
 void mpatch_crc32_final(const uint32_t *const crc32, uint8_t *const result);
-void mpatch_crc32_compute(const uint8_t *const msg, const uint_fast32_t size, uint8_t *const result);
+void mpatch_crc32_compute(const uint8_t *const msg, const size_t size, uint8_t *const result);
 
 #endif /*_INC_RHASH_CRC32_H*/
@@ -162,7 +162,7 @@ static void rhash_md5_process_block(uint32_t state[4], const uint32_t *const x)
  * @param msg message chunk
  * @param size length of the message chunk
  */
-void mpatch_md5_update(md5_ctx *const ctx, const uint8_t *msg, uint_fast32_t size)
+void mpatch_md5_update(md5_ctx *const ctx, const uint8_t *msg, size_t size)
 {
 	uint32_t index = (uint32_t)ctx->length & 63;
 	ctx->length += size;
@@ -235,7 +235,7 @@ void mpatch_md5_final(md5_ctx *const ctx, uint_fast8_t *const result)
 	if (result) le32_copy(result, 0, &ctx->hash, 16);
 }
 
-void mpatch_md5_digest(const uint_fast8_t *const msg, const uint_fast32_t size, uint8_t *const result)
+void mpatch_md5_digest(const uint_fast8_t *const msg, const size_t size, uint8_t *const result)
 {
 	md5_ctx state;
 	mpatch_md5_init(&state);
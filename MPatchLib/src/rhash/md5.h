@@ -18,6 +18,7 @@
 #define _INC_RHASH_MD5_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 #define md5_block_size 64U
 #define md5_hash_size  16U
@@ -34,8 +35,8 @@ md5_ctx;
 /* hash functions */
 
 void mpatch_md5_init(md5_ctx *const ctx);
-void mpatch_md5_update(md5_ctx *const ctx, const uint8_t *msg, uint_fast32_t size);
+void mpatch_md5_update(md5_ctx *const ctx, const uint8_t *msg, size_t size);
 void mpatch_md5_final(md5_ctx *const ctx, uint_fast8_t *const result);
-void mpatch_md5_digest(const uint_fast8_t *const msg, const uint_fast32_t size, uint8_t *const result);
+void mpatch_md5_digest(const uint_fast8_t *const msg, const size_t size, uint8_t *const result);
 
 #endif /*_INC_RHASH_MD5_H*/
@@ -0,0 +1,92 @@
+/* ---------------------------------------------------------------------------------------------- */
+/* MPatchLib - patch and compression library                                                      */
+/* Copyright(c) 2018 LoRd_MuldeR <mulder2@gmx.de>                                                 */
+/*                                                                                                */
+/* Permission is hereby granted, free of charge, to any person obtaining a copy of this software  */
+/* and associated documentation files (the "Software"), to deal in the Software without           */
+/* restriction, including without limitation the rights to use, copy, modify, merge, publish,     */
+/* distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the  */
+/* Software is furnished to do so, subject to the following conditions:                           */
+/*                                                                                                */
+/* The above copyright notice and this permission notice shall be included in all copies or       */
+/* substantial portions of the Software.                                                          */
+/*                                                                                                */
+/* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING  */
+/* BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND     */
+/* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,   */
+/* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, */
+/* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.        */
+/* ---------------------------------------------------------------------------------------------- */
+#ifndef _INC_MPATCH_SEGMENT_H
+#define _INC_MPATCH_SEGMENT_H
+
+#include "utils.h"
+#include "dictionary.h"
+
+/*
+ * A segmented patch divides the message into segments of "segment_size" bytes (a multiple of LITERAL_BLOCK), which are
+ * encoded as independent token streams: no chunk crosses a segment boundary, "prev_offset" is reset to zero at the start
+ * of each segment, and the dictionary tail never reaches back into the previous segment (see dictionary.h). Each segment
+ * starts at a byte boundary of the stream. The segment index, one entry per segment, is appended to the token stream
+ * (and thus covered by the footer checksums); it records where each segment starts in the output and in the stream, as
+ * well as the CRC-32 of the segment's output, so that segments can be decoded in parallel or individually. Offsets are
+ * 64-bit, but the number of segments is limited to 32-bit.
+ */
+
+typedef struct
+{
+	uint8_t output_offset[8U];
+	uint8_t patch_offset[8U];
+	uint8_t crc32[4U];
+}
+segment_entry_t;
+
+static __forceinline uint64_t segment_count_uint64(const uint64_t length_msg, const uint_fast32_t segment_size)
+{
+	return segment_size ? ((length_msg / segment_size) + ((length_msg % segment_size) ? 1U : 0U)) : 1U;
+}
+
+static __forceinline uint_fast32_t segment_count(const uint64_t length_msg, const uint_fast32_t segment_size)
+{
+	return (uint_fast32_t)segment_count_uint64(length_msg, segment_size); /*see valid_segment_count()*/
+}
+
+static __forceinline uint64_t segment_start(const uint64_t position, const uint_fast32_t segment_size)
+{
+	return segment_size ? (position - (position % segment_size)) : 0U;
+}
+
+static __forceinline uint64_t segment_end(const uint64_t position, const uint_fast32_t segment_size, const uint64_t length_msg)
+{
+	return segment_size ? min_uint64(segment_start(position, segment_size) + segment_size, length_msg) : length_msg;
+}
+
+static inline bool segment_slice(const segment_entry_t *const index, const uint_fast32_t segment_idx, const uint_fast32_t count, const uint_fast32_t segment_size, const uint64_t stream_len, uint64_t *const offset, uint64_t *const length)
+{
+	uint64_t output_offset, begin, end = stream_len;
+	dec_uint64(&output_offset, index[segment_idx].output_offset);
+	dec_uint64(&begin, index[segment_idx].patch_offset);
+	if (segment_idx + 1U < count)
+	{
+		dec_uint64(&end, index[segment_idx + 1U].patch_offset);
+	}
+	if ((output_offset != ((uint64_t)segment_idx) * segment_size) || (begin > end) || (end > stream_len))
+	{
+		return false;
+	}
+	*offset = begin;
+	*length = end - begin;
+	return true;
+}
+
+static inline bool valid_segment_size(const uint_fast32_t segment_size)
+{
+	return !(segment_size % LITERAL_BLOCK);
+}
+
+static inline bool valid_segment_count(const uint64_t length_msg, const uint_fast32_t segment_size)
+{
+	return segment_count_uint64(length_msg, segment_size) <= UINT32_MAX;
+}
+
+#endif /*_INC_MPATCH_SEGMENT_H*/
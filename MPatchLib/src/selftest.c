@@ -20,10 +20,16 @@
 #include "libmpatch.h"
 #include "utils.h"
 #include "bit_io.h"
+#include "compress.h"
+#include "pool.h"
+#include "substring.h"
 
 #include <stdlib.h>
 #include <malloc.h>
 #include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
 
 #define TEST_FAIL(X) do \
 { \
@@ -46,7 +52,7 @@ static bool _selftest_writer(const uint8_t *const data, const uint32_t size, con
 	selftest_io_t *const io = (selftest_io_t*)user_data;
 	if (size > 1U)
 	{
-		if (io->capacity - io->offset < size)
+		if (io->capacity - io->offset >= size)
 		{
 			memcpy(io->buffer + io->offset, data, size);
 			io->offset += size;
@@ -64,27 +70,280 @@ static bool _selftest_writer(const uint8_t *const data, const uint32_t size, con
 	return false;
 }
 
-static bool _selftest_reader(uint8_t *const data, const uint32_t size, const uintptr_t user_data)
+static uint32_t _selftest_reader(uint8_t *const data, const uint32_t size, const uintptr_t user_data)
 {
 	selftest_io_t *const io = (selftest_io_t*)user_data;
-	if (size > 1U)
+	const uint32_t len = (uint32_t)min_uint32(size, io->capacity - io->offset);
+	if (len)
+	{
+		memcpy(data, io->buffer + io->offset, len);
+		io->offset += len;
+	}
+	return len;
+}
+
+static bool _selftest_accessor(uint8_t *const data, const uint64_t offset, const uint32_t size, const uintptr_t user_data)
+{
+	const selftest_io_t *const io = (const selftest_io_t*)user_data;
+	if ((offset <= io->capacity) && (size <= io->capacity - offset))
+	{
+		memcpy(data, io->buffer + offset, size);
+		return true;
+	}
+	return false;
+}
+
+static bool _selftest_rewriter(const uint8_t *const data, const uint32_t size, const uint64_t offset, const uintptr_t user_data)
+{
+	selftest_io_t *const io = (selftest_io_t*)user_data;
+	if ((offset <= io->offset) && (size <= io->offset - offset))
+	{
+		memcpy(io->buffer + offset, data, size);
+		return true;
+	}
+	return false;
+}
+
+typedef struct
+{
+	uint8_t *buffer;
+	uint32_t size;
+	mpatch_checkpoint_t checkpoint;
+	uint32_t count;
+	uint32_t crash_at;
+}
+selftest_journal_t;
+
+static bool _selftest_journal(const uint8_t *const data, const uint32_t size, const mpatch_checkpoint_t *const checkpoint, const uintptr_t user_data)
+{
+	selftest_journal_t *const journal = (selftest_journal_t*)user_data;
+	memcpy(journal->buffer, data, journal->size = size);
+	memcpy(&journal->checkpoint, checkpoint, sizeof(mpatch_checkpoint_t));
+	return (++journal->count != journal->crash_at); /*simulate crash after the record was stored*/
+}
+
+typedef struct
+{
+	selftest_io_t io;
+	cancel_token_t open;
+}
+selftest_gate_t;
+
+static bool _selftest_gated_writer(const uint8_t *const data, const uint32_t size, const uintptr_t user_data)
+{
+	selftest_gate_t *const gate = (selftest_gate_t*)user_data;
+	while (!is_cancelled(&gate->open))
+	{
+		/*block until the gate is opened*/
+	}
+	return _selftest_writer(data, size, (uintptr_t)&gate->io);
+}
+
+typedef struct
+{
+	uint32_t count;
+	mpatch_error_t result;
+}
+selftest_completion_t;
+
+static void _selftest_completion(const mpatch_error_t result, const uintptr_t user_data)
+{
+	selftest_completion_t *const completion = (selftest_completion_t*)user_data;
+	completion->result = result;
+	completion->count++;
+}
+
+typedef struct
+{
+	uint64_t effort_bytes[4U];
+	uint32_t effort_lines;
+	uint64_t memory_estimate;
+}
+selftest_trace_t;
+
+static void _selftest_trace(const char *const format, const uintptr_t user_data, ...)
+{
+	selftest_trace_t *const trace = (selftest_trace_t*)user_data;
+	if (!strncmp(format, "level_", 6U)) /*"[EFFORT]" section, the arguments are the level and the number of bytes*/
 	{
-		if (io->capacity - io->offset < size)
+		va_list args;
+		va_start(args, user_data);
+		const size_t level = va_arg(args, size_t);
+		const uint64_t bytes = va_arg(args, uint64_t);
+		va_end(args);
+		if (level < 4U)
 		{
-			memcpy(data, io->buffer + io->offset, size);
-			io->offset += size;
-			return true;
+			trace->effort_bytes[level] = bytes;
+			trace->effort_lines++;
 		}
 	}
-	else if (size == 1U)
+	else if (!strncmp(format, "memory_estimate:", 16U))
 	{
-		if (io->offset < io->capacity)
+		va_list args;
+		va_start(args, user_data);
+		trace->memory_estimate = va_arg(args, uint64_t);
+		va_end(args);
+	}
+}
+
+typedef struct
+{
+	mpatch_job_t *job;
+	mpatch_error_t result;
+	cancel_token_t done;
+}
+selftest_release_t;
+
+static void _selftest_release(const mpatch_error_t result, const uintptr_t user_data)
+{
+	selftest_release_t *const release = (selftest_release_t*)user_data;
+	release->result = (result == MPATCH_SUCCESS) ? mpatch_job_destroy(&release->job) : result;
+	set_cancelled(&release->done);
+}
+
+typedef struct
+{
+	thread_pool_t *thread_pool;
+	uint32_t depth;
+	uint32_t node_count;
+}
+selftest_task_t;
+
+static void _selftest_task(const uintptr_t user_data)
+{
+	selftest_task_t *const task = (selftest_task_t*)user_data;
+	task->node_count = 1U;
+	if (task->depth)
+	{
+		selftest_task_t children[4U];
+		pool_task_t task_queue[4U];
+		for (uint_fast32_t i = 0U; i < 4U; ++i)
 		{
-			*data = io->buffer[io->offset++];
-			return true;
+			children[i].thread_pool = task->thread_pool;
+			children[i].depth = task->depth - 1U;
+			children[i].node_count = 0U;
+			task_queue[i].func = _selftest_task;
+			task_queue[i].data = (uintptr_t)&children[i];
+		}
+		mpatch_pool_exec(task->thread_pool, task_queue, 4U);
+		for (uint_fast32_t i = 0U; i < 4U; ++i)
+		{
+			task->node_count += children[i].node_count;
 		}
 	}
-	return false;
+}
+
+typedef struct
+{
+	uint_fast32_t reference_size;
+	uint_fast32_t message_size;
+	uint8_t *reference;
+	uint8_t *message;
+	uint8_t *output;
+	selftest_io_t io;
+}
+selftest_fixture_t;
+
+static uint8_t _selftest_byte(const uint_fast32_t i, const uint_fast32_t period, const int odds)
+{
+	const uint_fast32_t value = (rand() % odds) ? (i % period) : (uint_fast32_t)rand();
+	return (uint8_t)value;
+}
+
+static void _selftest_fixture_alloc(selftest_fixture_t *const fixture, const uint_fast32_t reference_size, const uint_fast32_t message_size)
+{
+	fixture->reference_size = reference_size;
+	fixture->message_size = message_size;
+	fixture->reference = (uint8_t*)malloc(reference_size * sizeof(uint8_t));
+	fixture->message = (uint8_t*)malloc(message_size * sizeof(uint8_t));
+	fixture->output = (uint8_t*)malloc(message_size * sizeof(uint8_t));
+	fixture->io.capacity = (uint32_t)(2U * message_size);
+	fixture->io.offset = 0U;
+	if (!((fixture->io.buffer = (uint8_t*)malloc(fixture->io.capacity * sizeof(uint8_t))) && fixture->reference && fixture->message && fixture->output))
+	{
+		TEST_FAIL("Memory allocation has failed!");
+	}
+}
+
+static void _selftest_fixture_edit(selftest_fixture_t *const fixture, const unsigned int seed, const uint_fast32_t period, const uint_fast32_t edit_period, const uint_fast32_t noise_period, const uint_fast32_t shift, const uint_fast32_t drift)
+{
+	//Message is an edited copy of the reference, shifted by a (drifting) offset, with every n-th KiB replaced by noise
+	srand(seed);
+	for (uint_fast32_t i = 0U; i < fixture->reference_size; ++i)
+	{
+		fixture->reference[i] = _selftest_byte(i, period, 3);
+	}
+	for (uint_fast32_t i = 0U; i < fixture->message_size; ++i)
+	{
+		fixture->message[i] = ((i / 1024U) % edit_period) ? fixture->reference[(i + shift + drift * (i / 16384U)) % fixture->reference_size] : _selftest_byte(i, noise_period, 4);
+	}
+}
+
+static void _selftest_fixture_free(selftest_fixture_t *const fixture)
+{
+	free(fixture->reference);
+	free(fixture->message);
+	free(fixture->output);
+	free(fixture->io.buffer);
+	memset(fixture, 0, sizeof(selftest_fixture_t));
+}
+
+static void _selftest_enc_param(const selftest_fixture_t *const fixture, mpatch_enc_param_t *const enc_param)
+{
+	memset(enc_param, 0, sizeof(mpatch_enc_param_t));
+	enc_param->message_in.buffer = fixture->message;
+	enc_param->message_in.capacity = fixture->message_size;
+	enc_param->reference_in.buffer = fixture->reference;
+	enc_param->reference_in.capacity = fixture->reference_size;
+	enc_param->compressed_out.writer_func = _selftest_writer;
+	enc_param->compressed_out.user_data = (uintptr_t)&fixture->io;
+}
+
+static void _selftest_dec_param(const selftest_fixture_t *const fixture, mpatch_dec_param_t *const dec_param)
+{
+	memset(dec_param, 0, sizeof(mpatch_dec_param_t));
+	dec_param->compressed_buf.buffer = fixture->io.buffer;
+	dec_param->compressed_buf.capacity = fixture->io.offset;
+	dec_param->reference_in.buffer = fixture->reference;
+	dec_param->reference_in.capacity = fixture->reference_size;
+	dec_param->message_out.buffer = fixture->output;
+	dec_param->message_out.capacity = fixture->message_size;
+}
+
+static bool _selftest_same_patch(const uint8_t *const patch_a, const uint32_t size_a, const uint8_t *const patch_b, const uint32_t size_b)
+{
+	//Compare byte by byte, except for the time stamp (bytes 8 to 11) and the header checksum that covers it (bytes 84 to 99)
+	if ((size_a != size_b) || (size_a < 100U))
+	{
+		return false;
+	}
+	return !(memcmp(patch_a, patch_b, 8U) || memcmp(patch_a + 12U, patch_b + 12U, 72U) || memcmp(patch_a + 100U, patch_b + 100U, size_a - 100U));
+}
+
+static void _selftest_verify(selftest_fixture_t *const fixture, mpatch_enc_param_t *const enc_param, const uint32_t thread_count, mpatch_thread_pool_t *const thread_pool)
+{
+	//Encode (unless the patch has already been written), then decode from memory and compare
+	if (enc_param)
+	{
+		fixture->io.offset = 0U;
+		if (mpatch_encode(enc_param) != MPATCH_SUCCESS)
+		{
+			TEST_FAIL("Failed to encode the patch!");
+		}
+	}
+	mpatch_dec_param_t dec_param;
+	_selftest_dec_param(fixture, &dec_param);
+	dec_param.thread_count = thread_count;
+	dec_param.thread_pool = thread_pool;
+	memset(fixture->output, 0, fixture->message_size);
+	if (mpatch_decode(&dec_param) != MPATCH_SUCCESS)
+	{
+		TEST_FAIL("Failed to decode the patch!");
+	}
+	if (memcmp(fixture->output, fixture->message, fixture->message_size))
+	{
+		TEST_FAIL("Data validation has failed!");
+	}
 }
 
 static void selftest_bit_iofunc(void)
@@ -162,7 +421,7 @@ static void selftest_exp_golomb(void)
 	const uint_fast32_t MAX_TEST_VALUE = 4211U;
 
 	//Init I/O routines
-	selftest_io_t io = { NULL, 32768U, 0U };
+	selftest_io_t io = { NULL, 65536U, 0U };
 	if (!(io.buffer = (uint8_t*)malloc(io.capacity * sizeof(uint8_t))))
 	{
 		TEST_FAIL("Memory allocation has failed!");
@@ -186,9 +445,19 @@ static void selftest_exp_golomb(void)
 			TEST_FAIL("Failed to write number!");
 		}
 	}
+	for (uint_fast32_t k = 0U; k < 64U; ++k)
+	{
+		if (!(exp_golomb_write(((uint64_t)1U) << k, &writer, &wr_state) && exp_golomb_write(UINT64_MAX >> k, &writer, &wr_state) && write_bit(k & 1U, &writer, &wr_state)))
+		{
+			TEST_FAIL("Failed to write number!");
+		}
+	}
 
 	//Rewind the I/O buffer
-	flush_state(&writer, &wr_state);
+	if (!flush_state(&writer, &wr_state))
+	{
+		TEST_FAIL("Failed to flush data!");
+	}
 	io.offset = 0U;
 
 	//Read numbers (and validate)
@@ -197,26 +466,39 @@ static void selftest_exp_golomb(void)
 	init_io_state(&rd_state);
 	for (uint_fast32_t i = 0U; i < MAX_TEST_VALUE; ++i)
 	{
-		uint_fast32_t value_ui32;
+		uint64_t value_ui64;
 		uint8_t value_byte;
-		if (!(exp_golomb_read(&value_ui32, &reader, &rd_state) && read_byte(&value_byte, &reader, &rd_state)))
+		if (!(exp_golomb_read(&value_ui64, &reader, &rd_state) && read_byte(&value_byte, &reader, &rd_state)))
 		{
 			TEST_FAIL("Failed to read number!");
 		}
-		if ((value_ui32 != i) || (value_byte != (uint8_t)i))
+		if ((value_ui64 != i) || (value_byte != (uint8_t)i))
 		{
 			TEST_FAIL("Data validation has failed!");
 		}
 	}
 	for (uint_fast32_t i = MAX_TEST_VALUE; i > 0U; --i)
 	{
-		uint_fast32_t value_ui32;
+		uint64_t value_ui64;
 		uint8_t value_byte;
-		if (!(exp_golomb_read(&value_ui32, &reader, &rd_state) && read_byte(&value_byte, &reader, &rd_state)))
+		if (!(exp_golomb_read(&value_ui64, &reader, &rd_state) && read_byte(&value_byte, &reader, &rd_state)))
+		{
+			TEST_FAIL("Failed to read number!");
+		}
+		if ((value_ui64 != i) || (value_byte != (uint8_t)i))
+		{
+			TEST_FAIL("Data validation has failed!");
+		}
+	}
+	for (uint_fast32_t k = 0U; k < 64U; ++k)
+	{
+		uint64_t value_ui64[2U];
+		bool value_bit;
+		if (!(exp_golomb_read(&value_ui64[0U], &reader, &rd_state) && exp_golomb_read(&value_ui64[1U], &reader, &rd_state) && read_bit(&value_bit, &reader, &rd_state)))
 		{
 			TEST_FAIL("Failed to read number!");
 		}
-		if ((value_ui32 != i) || (value_byte != (uint8_t)i))
+		if ((value_ui64[0U] != (((uint64_t)1U) << k)) || (value_ui64[1U] != (UINT64_MAX >> k)) || (value_bit != BOOLIFY(k & 1U)))
 		{
 			TEST_FAIL("Data validation has failed!");
 		}
@@ -284,10 +566,1235 @@ static void selftest_bit_crc32c(void)
 	}
 }
 
-void mpatch_selftest()
+static void selftest_bit_digest(void)
 {
-	selftest_bit_iofunc();
-	selftest_exp_golomb();
-	selftest_bit_crc32c();
-	selftest_bit_md5dig();
+	//Init I/O routines
+	selftest_io_t io = { NULL, 262144U, 0U };
+	io_state_t *const wr_state = (io_state_t*)malloc(sizeof(io_state_t));
+	uint8_t *const data = (uint8_t*)malloc(128U * sizeof(uint8_t));
+	if (!((io.buffer = (uint8_t*)malloc(io.capacity * sizeof(uint8_t))) && wr_state && data))
+	{
+		TEST_FAIL("Memory allocation has failed!");
+	}
+
+	//Create thread pool
+	thread_pool_t *thread_pool = NULL;
+	if (!mpatch_pool_create(&thread_pool, 2U, false))
+	{
+		TEST_FAIL("Failed to create thread pool!");
+	}
+
+	for (uint_fast32_t pass = 0U; pass < 2U; ++pass)
+	{
+		//Write data (mixed bits and bytes)
+		const mpatch_writer_t writer = { _selftest_writer, (uintptr_t)&io };
+		init_io_state(wr_state);
+		wr_state->hash_pool = pass ? thread_pool : NULL;
+		io.offset = 0U;
+		srand(777);
+		for (uint_fast32_t i = 0U; i < 4096U; ++i)
+		{
+			const uint_fast32_t len = rand() % 97U;
+			for (uint_fast32_t j = 0U; j < len; ++j)
+			{
+				data[j] = (uint8_t)rand();
+			}
+			if (!(write_bit(rand() & 1, &writer, wr_state) && write_bytes(data, len, &writer, wr_state)))
+			{
+				TEST_FAIL("Failed to write data!");
+			}
+		}
+		if (!flush_state(&writer, wr_state))
+		{
+			TEST_FAIL("Failed to flush data!");
+		}
+
+		//Compute reference checksums (byte by byte)
+		md5_ctx md5_ref;
+		uint32_t crc32_ref;
+		mpatch_md5_init(&md5_ref);
+		mpatch_crc32_init(&crc32_ref);
+		for (uint_fast32_t i = 0U; i < io.offset; ++i)
+		{
+			mpatch_md5_update(&md5_ref, io.buffer + i, 1U);
+			mpatch_crc32_update(&crc32_ref, io.buffer + i, 1U);
+		}
+
+		//Validate checksums
+		uint8_t digest[2U][16U], crc32[2U][4U];
+		mpatch_md5_final(&wr_state->md5_ctx, digest[0U]);
+		mpatch_md5_final(&md5_ref, digest[1U]);
+		mpatch_crc32_final(&wr_state->crc32_ctx, crc32[0U]);
+		mpatch_crc32_final(&crc32_ref, crc32[1U]);
+		if ((wr_state->byte_counter != io.offset) || memcmp(digest[0U], digest[1U], 16U) || memcmp(crc32[0U], crc32[1U], 4U))
+		{
+			TEST_FAIL("Data validation has failed!");
+		}
+	}
+
+	//Clean-up
+	mpatch_pool_destroy(&thread_pool);
+	free(data);
+	free(wr_state);
+	free(io.buffer);
+}
+
+static void selftest_codec_roundtrip(void)
+{
+	static const uint_fast32_t CHUNK_SIZE = 2048U, CHUNK_COUNT = 192U;
+
+	//Allocate buffers
+	uint8_t *const dictionary = (uint8_t*)malloc(CHUNK_SIZE * sizeof(uint8_t));
+	uint8_t *const message = (uint8_t*)malloc(CHUNK_SIZE * CHUNK_COUNT * sizeof(uint8_t));
+	uint8_t *const decoded = (uint8_t*)malloc(CHUNK_SIZE * sizeof(uint8_t));
+	if (!(dictionary && message && decoded))
+	{
+		TEST_FAIL("Memory allocation has failed!");
+	}
+
+	//Generate test data (partly redundant)
+	srand(42);
+	for (uint_fast32_t i = 0U; i < CHUNK_SIZE; ++i)
+	{
+		dictionary[i] = (uint8_t)(rand() % 16);
+	}
+	for (uint_fast32_t i = 0U; i < CHUNK_SIZE * CHUNK_COUNT; ++i)
+	{
+		message[i] = (rand() % 4) ? dictionary[(i * 7U) % CHUNK_SIZE] : (uint8_t)rand();
+	}
+
+	for (mpatch_codec_t codec = MPATCH_CODEC_DEFLATE; codec <= MPATCH_CODEC_LZ77; ++codec)
+	{
+		//Create contexts
+		mpatch_cctx_t *cctx;
+		mpatch_dctx_t *dctx;
+		if (!(mpatch_compress_enc_init(&cctx, codec, CHUNK_SIZE) && mpatch_compress_dec_init(&dctx, codec, CHUNK_SIZE)))
+		{
+			TEST_FAIL("Failed to create codec context!");
+		}
+		if (!(mpatch_compress_enc_load(cctx, dictionary, CHUNK_SIZE) && mpatch_compress_dec_load(dctx, dictionary, CHUNK_SIZE)))
+		{
+			TEST_FAIL("Failed to load dictionary!");
+		}
+
+		//Compress and decompress chunks of varying size
+		for (uint_fast32_t k = 0U; k < CHUNK_COUNT; ++k)
+		{
+			const uint8_t *const chunk = message + (k * CHUNK_SIZE);
+			const uint_fast32_t chunk_len = 1U + ((k * 331U) % CHUNK_SIZE);
+			uint_fast32_t compressed_size, decoded_size;
+			if ((k % 3U) && (mpatch_compress_enc_test(cctx, chunk, chunk_len) == UINT_FAST32_MAX))
+			{
+				TEST_FAIL("Failed to test chunk!");
+			}
+			const uint8_t *const compressed = mpatch_compress_enc_next(cctx, chunk, chunk_len, &compressed_size);
+			if (!(compressed && mpatch_compress_dec_next(dctx, compressed, compressed_size, decoded, CHUNK_SIZE, &decoded_size)))
+			{
+				TEST_FAIL("Failed to process chunk!");
+			}
+			if ((decoded_size != chunk_len) || memcmp(decoded, chunk, chunk_len))
+			{
+				TEST_FAIL("Data validation has failed!");
+			}
+		}
+
+		//Clean-up contexts
+		mpatch_compress_enc_free(&cctx);
+		mpatch_compress_dec_free(&dctx);
+	}
+
+	//Clean-up memory
+	free(dictionary);
+	free(message);
+	free(decoded);
+}
+
+static void selftest_patch_roundtrip(void)
+{
+	static const uint_fast32_t DATA_SIZE = 98304U;
+
+	//Generate test data
+	selftest_fixture_t fixture;
+	_selftest_fixture_alloc(&fixture, DATA_SIZE, DATA_SIZE);
+	_selftest_fixture_edit(&fixture, 4711U, 61U, 5U, 7U, 4096U, 0U);
+
+	for (mpatch_codec_t codec = MPATCH_CODEC_DEFLATE; codec <= MPATCH_CODEC_LZ77; ++codec)
+	{
+		//Encode, then decode from memory
+		mpatch_enc_param_t enc_param;
+		_selftest_enc_param(&fixture, &enc_param);
+		enc_param.codec = codec;
+		_selftest_verify(&fixture, &enc_param, 0U, NULL);
+
+		//Decode from a reader
+		selftest_io_t patch_io = { fixture.io.buffer, fixture.io.offset, 0U };
+		mpatch_dec_param_t dec_param;
+		_selftest_dec_param(&fixture, &dec_param);
+		memset(&dec_param.compressed_buf, 0, sizeof(mpatch_rd_buffer_t));
+		dec_param.compressed_in.reader_func = _selftest_reader;
+		dec_param.compressed_in.user_data = (uintptr_t)&patch_io;
+		memset(fixture.output, 0, DATA_SIZE);
+		if (mpatch_decode(&dec_param) != MPATCH_SUCCESS)
+		{
+			TEST_FAIL("Failed to decode the patch!");
+		}
+		if (memcmp(fixture.output, fixture.message, DATA_SIZE))
+		{
+			TEST_FAIL("Data validation has failed!");
+		}
+
+		//Decode in "streaming" mode
+		selftest_io_t reference_io = { fixture.reference, DATA_SIZE, 0U }, output_io = { fixture.output, DATA_SIZE, 0U };
+		_selftest_dec_param(&fixture, &dec_param);
+		memset(&dec_param.reference_in, 0, sizeof(mpatch_rd_buffer_t));
+		memset(&dec_param.message_out, 0, sizeof(mpatch_wr_buffer_t));
+		dec_param.reference_acc.accessor_func = _selftest_accessor;
+		dec_param.reference_acc.length = DATA_SIZE;
+		dec_param.reference_acc.user_data = (uintptr_t)&reference_io;
+		dec_param.message_wr.writer_func = _selftest_writer;
+		dec_param.message_wr.user_data = (uintptr_t)&output_io;
+		memset(fixture.output, 0, DATA_SIZE);
+		if (mpatch_decode(&dec_param) != MPATCH_SUCCESS)
+		{
+			TEST_FAIL("Failed to decode the patch in streaming mode!");
+		}
+		if ((output_io.offset != DATA_SIZE) || memcmp(fixture.output, fixture.message, DATA_SIZE))
+		{
+			TEST_FAIL("Data validation has failed!");
+		}
+
+		//Decode with corrupted data
+		fixture.io.buffer[fixture.io.offset / 2U] ^= 0x10;
+		output_io.offset = 0U;
+		if (mpatch_decode(&dec_param) == MPATCH_SUCCESS)
+		{
+			TEST_FAIL("Corrupted patch was not detected!");
+		}
+	}
+
+	//Clean-up memory
+	_selftest_fixture_free(&fixture);
+}
+
+static void selftest_patch_in_place(void)
+{
+	static const uint_fast32_t DATA_SIZE = 131072U;
+
+	//Allocate buffers
+	selftest_io_t io = { NULL, 2U * DATA_SIZE, 0U };
+	selftest_journal_t journal = { NULL, 0U, { 0U, 0U, 0U, 0U, 0U }, 0U, 0U };
+	uint8_t *const reference = (uint8_t*)malloc(DATA_SIZE * sizeof(uint8_t));
+	uint8_t *const message = (uint8_t*)malloc(DATA_SIZE * sizeof(uint8_t));
+	uint8_t *const shared = (uint8_t*)malloc(DATA_SIZE * sizeof(uint8_t));
+	if (!((io.buffer = (uint8_t*)malloc(io.capacity * sizeof(uint8_t))) && (journal.buffer = (uint8_t*)malloc(DATA_SIZE * sizeof(uint8_t))) && reference && message && shared))
+	{
+		TEST_FAIL("Memory allocation has failed!");
+	}
+
+	//Generate test data (message is an edited copy of the reference)
+	srand(4712);
+	for (uint_fast32_t i = 0U; i < DATA_SIZE; ++i)
+	{
+		reference[i] = _selftest_byte(i, 59U, 3);
+	}
+	for (uint_fast32_t i = 0U; i < DATA_SIZE; ++i)
+	{
+		message[i] = ((i / 1024U) % 7U) ? reference[(i + ((i / 8192U) % 2U) * 4096U) % DATA_SIZE] : _selftest_byte(i, 5U, 4);
+	}
+
+	//Encode
+	mpatch_enc_param_t enc_param;
+	memset(&enc_param, 0, sizeof(mpatch_enc_param_t));
+	enc_param.message_in.buffer = message;
+	enc_param.message_in.capacity = DATA_SIZE;
+	enc_param.reference_in.buffer = reference;
+	enc_param.reference_in.capacity = DATA_SIZE;
+	enc_param.compressed_out.writer_func = _selftest_writer;
+	enc_param.compressed_out.user_data = (uintptr_t)&io;
+	enc_param.flags = MPATCH_FLAG_IN_PLACE;
+	if (mpatch_encode(&enc_param) != MPATCH_SUCCESS)
+	{
+		TEST_FAIL("Failed to encode the patch!");
+	}
+
+	//Decode in-place
+	mpatch_dec_param_t dec_param;
+	memset(&dec_param, 0, sizeof(mpatch_dec_param_t));
+	dec_param.compressed_buf.buffer = io.buffer;
+	dec_param.compressed_buf.capacity = io.offset;
+	dec_param.reference_in.buffer = shared;
+	dec_param.reference_in.capacity = DATA_SIZE;
+	dec_param.message_out.buffer = shared;
+	dec_param.message_out.capacity = DATA_SIZE;
+	dec_param.journal.journal_func = _selftest_journal;
+	dec_param.journal.user_data = (uintptr_t)&journal;
+	memcpy(shared, reference, DATA_SIZE);
+	if (mpatch_decode(&dec_param) != MPATCH_SUCCESS)
+	{
+		TEST_FAIL("Failed to decode the patch in-place!");
+	}
+	if ((journal.count < 2U) || memcmp(shared, message, DATA_SIZE))
+	{
+		TEST_FAIL("Data validation has failed!");
+	}
+
+	//Interrupt, then recover from the journal
+	memcpy(shared, reference, DATA_SIZE);
+	journal.crash_at = journal.count / 2U;
+	journal.count = 0U;
+	if (mpatch_decode(&dec_param) == MPATCH_SUCCESS)
+	{
+		TEST_FAIL("Decoder was not interrupted!");
+	}
+	memcpy(shared + (journal.checkpoint.output_pos - journal.size), journal.buffer, journal.size);
+	journal.crash_at = 0U;
+	dec_param.resume = &journal.checkpoint;
+	if (mpatch_decode(&dec_param) != MPATCH_SUCCESS)
+	{
+		TEST_FAIL("Failed to resume the in-place decoder!");
+	}
+	if (memcmp(shared, message, DATA_SIZE))
+	{
+		TEST_FAIL("Data validation has failed!");
+	}
+
+	//Clean-up memory
+	free(reference);
+	free(message);
+	free(shared);
+	free(journal.buffer);
+	free(io.buffer);
+}
+
+static void selftest_patch_segmented(void)
+{
+	static const uint_fast32_t DATA_SIZE = 233472U, SEGMENT_SIZE = 65536U, RANGE_OFFSET = 60000U, RANGE_LENGTH = 80000U;
+
+	//Generate test data
+	selftest_fixture_t fixture;
+	_selftest_fixture_alloc(&fixture, DATA_SIZE, DATA_SIZE);
+	_selftest_fixture_edit(&fixture, 4713U, 61U, 5U, 7U, 0U, 7U);
+
+	//Encode
+	mpatch_enc_param_t enc_param;
+	_selftest_enc_param(&fixture, &enc_param);
+	enc_param.segment_size = SEGMENT_SIZE + 1U;
+	if (mpatch_encode(&enc_param) != MPATCH_INVALID_PARAMETER)
+	{
+		TEST_FAIL("Unaligned segment size was accepted!");
+	}
+	enc_param.segment_size = SEGMENT_SIZE;
+
+	//Encode serially and in parallel, then decode serially and in parallel (the patch must not depend on the thread count)
+	uint8_t *const serial_patch = (uint8_t*)malloc(fixture.io.capacity * sizeof(uint8_t));
+	uint32_t serial_size = 0U;
+	if (!serial_patch)
+	{
+		TEST_FAIL("Memory allocation has failed!");
+	}
+	static const uint32_t ENC_THREADS[3U] = { 1U, 3U, 20U };
+	for (uint32_t k = 0U; k < 3U; ++k)
+	{
+		enc_param.thread_count = ENC_THREADS[k];
+		_selftest_verify(&fixture, &enc_param, 1U, NULL);
+		_selftest_verify(&fixture, NULL, 3U, NULL);
+		if (!k)
+		{
+			memcpy(serial_patch, fixture.io.buffer, serial_size = fixture.io.offset);
+		}
+		else if (!_selftest_same_patch(fixture.io.buffer, fixture.io.offset, serial_patch, serial_size))
+		{
+			TEST_FAIL("Parallel patch differs from the serial patch!");
+		}
+	}
+
+	//Encode with a tiny time budget, so the effort gets reduced (according to the stats), the patch must still decode
+	selftest_trace_t trace;
+	memset(&trace, 0, sizeof(selftest_trace_t));
+	enc_param.thread_count = 3U;
+	enc_param.time_budget = 1U;
+	enc_param.trace_logger.logging_func = _selftest_trace;
+	enc_param.trace_logger.user_data = (uintptr_t)&trace;
+	_selftest_verify(&fixture, &enc_param, 3U, NULL);
+	if ((trace.effort_lines != 4U) || (trace.effort_bytes[0U] + trace.effort_bytes[1U] + trace.effort_bytes[2U] + trace.effort_bytes[3U] != DATA_SIZE))
+	{
+		TEST_FAIL("Effort stats are missing or incomplete!");
+	}
+	if (trace.effort_bytes[0U] == DATA_SIZE)
+	{
+		TEST_FAIL("Effort was not reduced!");
+	}
+	enc_param.time_budget = 0U;
+	memset(&enc_param.trace_logger, 0, sizeof(mpatch_logger_t));
+
+	//Encode and decode with a shared thread pool (pinned, so the reference gets copied), the patch must not change
+	mpatch_thread_pool_t *shared_pool = NULL;
+	if (mpatch_thread_pool_create(&shared_pool, 3U, MPATCH_POOL_PIN_THREADS) != MPATCH_SUCCESS)
+	{
+		TEST_FAIL("Failed to create thread pool!");
+	}
+	enc_param.thread_count = 0U;
+	enc_param.thread_pool = shared_pool;
+	_selftest_verify(&fixture, &enc_param, 0U, shared_pool);
+	if (!_selftest_same_patch(fixture.io.buffer, fixture.io.offset, serial_patch, serial_size))
+	{
+		TEST_FAIL("Pinned patch differs from the serial patch!");
+	}
+	free(serial_patch);
+	if (mpatch_thread_pool_destroy(&shared_pool) != MPATCH_SUCCESS)
+	{
+		TEST_FAIL("Failed to destroy thread pool!");
+	}
+	enc_param.thread_pool = NULL;
+
+	//Extract a range that spans several segments
+	mpatch_ext_param_t ext_param;
+	memset(&ext_param, 0, sizeof(mpatch_ext_param_t));
+	ext_param.compressed_buf.buffer = fixture.io.buffer;
+	ext_param.compressed_buf.capacity = fixture.io.offset;
+	ext_param.reference_in.buffer = fixture.reference;
+	ext_param.reference_in.capacity = DATA_SIZE;
+	ext_param.offset = RANGE_OFFSET;
+	ext_param.message_out.buffer = fixture.output;
+	ext_param.message_out.capacity = RANGE_LENGTH;
+	if (mpatch_extract(&ext_param) != MPATCH_SUCCESS)
+	{
+		TEST_FAIL("Failed to extract the range!");
+	}
+	if (memcmp(fixture.output, fixture.message + RANGE_OFFSET, RANGE_LENGTH))
+	{
+		TEST_FAIL("Data validation has failed!");
+	}
+
+	//Corrupt the stream, parallel decode must fail
+	mpatch_dec_param_t dec_param;
+	_selftest_dec_param(&fixture, &dec_param);
+	dec_param.thread_count = 3U;
+	fixture.io.buffer[fixture.io.offset / 2U] ^= 0x5A;
+	if (mpatch_decode(&dec_param) == MPATCH_SUCCESS)
+	{
+		TEST_FAIL("Corruption was not detected!");
+	}
+
+	//Clean-up memory
+	_selftest_fixture_free(&fixture);
+}
+
+static void selftest_patch_streamed(void)
+{
+	static const uint_fast32_t DATA_SIZE = 409600U, SEGMENT_SIZE = 131072U;
+
+	//Generate test data
+	selftest_fixture_t fixture;
+	_selftest_fixture_alloc(&fixture, DATA_SIZE, DATA_SIZE);
+	_selftest_fixture_edit(&fixture, 4715U, 53U, 6U, 9U, 0U, 5U);
+
+	//Set up parameters, with the smallest lookahead, so the window has to be moved several times
+	mpatch_limit_t limits;
+	mpatch_get_limits(&limits);
+	mpatch_enc_param_t enc_param;
+	_selftest_enc_param(&fixture, &enc_param);
+	memset(&enc_param.message_in, 0, sizeof(mpatch_rd_buffer_t));
+	enc_param.header_out.rewriter_func = _selftest_rewriter;
+	enc_param.header_out.user_data = (uintptr_t)&fixture.io;
+	enc_param.lookahead = limits.min_lookahead - 1U;
+	mpatch_enc_stream_t *stream = NULL;
+	if (mpatch_encode_begin(&stream, &enc_param) != MPATCH_INVALID_PARAMETER)
+	{
+		TEST_FAIL("Too small lookahead was accepted!");
+	}
+	enc_param.lookahead = limits.min_lookahead;
+
+	//Push the message in pieces of varying size, unsegmented and segmented, then decode
+	for (uint32_t k = 0U; k < 2U; ++k)
+	{
+		fixture.io.offset = 0U;
+		enc_param.segment_size = k ? SEGMENT_SIZE : 0U;
+		enc_param.thread_count = k ? 3U : 1U;
+		if (mpatch_encode_begin(&stream, &enc_param) != MPATCH_SUCCESS)
+		{
+			TEST_FAIL("Failed to begin the stream!");
+		}
+		for (uint_fast32_t offset = 0U, len; offset < DATA_SIZE; offset += len)
+		{
+			len = min_uint32(DATA_SIZE - offset, 1U + (rand() % 40000));
+			if (mpatch_encode_push(stream, fixture.message + offset, len) != MPATCH_SUCCESS)
+			{
+				TEST_FAIL("Failed to push the message!");
+			}
+		}
+		if ((mpatch_encode_finish(&stream) != MPATCH_SUCCESS) || stream)
+		{
+			TEST_FAIL("Failed to finish the stream!");
+		}
+		_selftest_verify(&fixture, NULL, k ? 3U : 1U, NULL);
+	}
+
+	//An incomplete patch must be rejected
+	fixture.io.offset = 0U;
+	if ((mpatch_encode_begin(&stream, &enc_param) != MPATCH_SUCCESS) || (mpatch_encode_push(stream, fixture.message, DATA_SIZE) != MPATCH_SUCCESS) || (mpatch_encode_abort(&stream) != MPATCH_SUCCESS))
+	{
+		TEST_FAIL("Failed to abort the stream!");
+	}
+	mpatch_dec_param_t dec_param;
+	_selftest_dec_param(&fixture, &dec_param);
+	if (mpatch_decode(&dec_param) != MPATCH_HEADER_CORRUPTED)
+	{
+		TEST_FAIL("Incomplete patch was not detected!");
+	}
+
+	//Clean-up memory
+	_selftest_fixture_free(&fixture);
+}
+
+static void selftest_patch_windowed(void)
+{
+	static const uint_fast32_t REFERENCE_SIZE = 1048576U, PIECE_COUNT = 64U, PIECE_SIZE = 4096U, NOISE_SIZE = 64U, SEGMENT_SIZE = 65536U;
+	static const uint_fast32_t DATA_SIZE = PIECE_COUNT * (PIECE_SIZE + NOISE_SIZE);
+
+	//Generate test data (message is made of pieces copied from random positions of the reference, separated by noise)
+	selftest_fixture_t fixture;
+	_selftest_fixture_alloc(&fixture, REFERENCE_SIZE, DATA_SIZE);
+	srand(4716);
+	for (uint_fast32_t i = 0U; i < REFERENCE_SIZE; ++i)
+	{
+		fixture.reference[i] = (uint8_t)rand();
+	}
+	for (uint_fast32_t p = 0U, i = 0U; p < PIECE_COUNT; ++p)
+	{
+		const uint_fast32_t offset = (((uint_fast32_t)rand() << 15U) ^ (uint_fast32_t)rand()) % (REFERENCE_SIZE - PIECE_SIZE);
+		memcpy(fixture.message + i, fixture.reference + offset, PIECE_SIZE);
+		for (i += PIECE_SIZE; i % (PIECE_SIZE + NOISE_SIZE); ++i)
+		{
+			fixture.message[i] = (uint8_t)rand();
+		}
+	}
+
+	//Set up parameters, with the smallest budget, so the reference has to be searched in windows
+	mpatch_limit_t limits;
+	mpatch_get_limits(&limits);
+	mpatch_enc_param_t enc_param;
+	_selftest_enc_param(&fixture, &enc_param);
+	enc_param.reference_budget = limits.min_reference_budget - 1U;
+	if (mpatch_encode(&enc_param) != MPATCH_INVALID_PARAMETER)
+	{
+		TEST_FAIL("Too small reference budget was accepted!");
+	}
+	enc_param.reference_budget = limits.min_reference_budget;
+
+	//Encode serially and in parallel, the pieces must be found, then decode
+	for (uint32_t k = 0U; k < 2U; ++k)
+	{
+		enc_param.segment_size = k ? SEGMENT_SIZE : 0U;
+		enc_param.thread_count = k ? 3U : 1U;
+		_selftest_verify(&fixture, &enc_param, 1U, NULL);
+		if (fixture.io.offset >= DATA_SIZE / 8U)
+		{
+			TEST_FAIL("Windowed search has missed the matches!");
+		}
+	}
+
+	//Encode within the smallest memory budget, so the structures get scaled down, the pieces must still be found
+	enc_param.reference_budget = 0U;
+	enc_param.memory_budget = 65536U;
+	if (mpatch_encode(&enc_param) != MPATCH_INVALID_PARAMETER)
+	{
+		TEST_FAIL("Too small memory budget was accepted!");
+	}
+	selftest_trace_t trace;
+	enc_param.trace_logger.logging_func = _selftest_trace;
+	enc_param.trace_logger.user_data = (uintptr_t)&trace;
+	for (uint32_t k = 0U; k < 2U; ++k)
+	{
+		memset(&trace, 0, sizeof(selftest_trace_t));
+		enc_param.memory_budget = k ? 4194304U : limits.min_memory_budget;
+		enc_param.segment_size = k ? SEGMENT_SIZE : 0U;
+		enc_param.thread_count = k ? 4U : 1U;
+		_selftest_verify(&fixture, &enc_param, 1U, NULL);
+		if (fixture.io.offset >= DATA_SIZE / 8U)
+		{
+			TEST_FAIL("Windowed search has missed the matches!");
+		}
+		if (!(trace.memory_estimate && (trace.memory_estimate <= enc_param.memory_budget)))
+		{
+			TEST_FAIL("Memory budget was exceeded!");
+		}
+	}
+
+	//Clean-up memory
+	_selftest_fixture_free(&fixture);
+}
+
+static void selftest_patch_async(void)
+{
+	static const uint_fast32_t DATA_SIZE = 98304U;
+
+	//Generate test data
+	selftest_fixture_t fixture;
+	_selftest_fixture_alloc(&fixture, DATA_SIZE, DATA_SIZE);
+	_selftest_fixture_edit(&fixture, 4714U, 61U, 5U, 7U, 2048U, 0U);
+
+	//Encode asynchronously, the completion handler must have run once the job is done
+	selftest_completion_t completion_data = { 0U, MPATCH_INTERNAL_ERROR };
+	const mpatch_completion_t completion = { _selftest_completion, (uintptr_t)&completion_data };
+	mpatch_enc_param_t enc_param;
+	_selftest_enc_param(&fixture, &enc_param);
+	enc_param.thread_count = 2U;
+	mpatch_job_t *job = NULL;
+	if (mpatch_encode_async(&job, &enc_param, &completion) != MPATCH_SUCCESS)
+	{
+		TEST_FAIL("Failed to start the job!");
+	}
+	memset(&enc_param, 0, sizeof(mpatch_enc_param_t)); /*the job has its own copy*/
+	mpatch_error_t result = MPATCH_INTERNAL_ERROR;
+	if ((mpatch_job_wait(job) != MPATCH_SUCCESS) || (!mpatch_job_poll(job, &result)) || (result != MPATCH_SUCCESS))
+	{
+		TEST_FAIL("Failed to encode the patch!");
+	}
+	if ((completion_data.count != 1U) || (completion_data.result != MPATCH_SUCCESS))
+	{
+		TEST_FAIL("Completion handler was not invoked!");
+	}
+	if (mpatch_job_destroy(&job) != MPATCH_SUCCESS)
+	{
+		TEST_FAIL("Failed to destroy the job!");
+	}
+
+	//Decode asynchronously
+	mpatch_dec_param_t dec_param;
+	_selftest_dec_param(&fixture, &dec_param);
+	if (mpatch_decode_async(&job, &dec_param, NULL) != MPATCH_SUCCESS)
+	{
+		TEST_FAIL("Failed to start the job!");
+	}
+	if (mpatch_job_wait(job) != MPATCH_SUCCESS)
+	{
+		TEST_FAIL("Failed to decode the patch!");
+	}
+	if (memcmp(fixture.output, fixture.message, DATA_SIZE))
+	{
+		TEST_FAIL("Data validation has failed!");
+	}
+	if (mpatch_job_destroy(&job) != MPATCH_SUCCESS)
+	{
+		TEST_FAIL("Failed to destroy the job!");
+	}
+
+	//Cancel a job while it is blocked in the writer, so it must stop before the first chunk
+	selftest_gate_t gate = { { fixture.io.buffer, fixture.io.capacity, 0U }, 0U };
+	_selftest_enc_param(&fixture, &enc_param);
+	enc_param.compressed_out.writer_func = _selftest_gated_writer;
+	enc_param.compressed_out.user_data = (uintptr_t)&gate;
+	completion_data.count = 0U;
+	if (mpatch_encode_async(&job, &enc_param, &completion) != MPATCH_SUCCESS)
+	{
+		TEST_FAIL("Failed to start the job!");
+	}
+	if (mpatch_job_cancel(job) != MPATCH_SUCCESS)
+	{
+		TEST_FAIL("Failed to cancel the job!");
+	}
+	set_cancelled(&gate.open);
+	if ((mpatch_job_wait(job) != MPATCH_CANCELLED_BY_USER) || (completion_data.count != 1U) || (completion_data.result != MPATCH_CANCELLED_BY_USER))
+	{
+		TEST_FAIL("Job was not cancelled!");
+	}
+	if (mpatch_job_destroy(&job) != MPATCH_SUCCESS)
+	{
+		TEST_FAIL("Failed to destroy the job!");
+	}
+
+	//Destroy a job from its own completion handler (the gate keeps the job from finishing before the handle is stored)
+	selftest_release_t release = { NULL, MPATCH_INTERNAL_ERROR, 0U };
+	const mpatch_completion_t release_completion = { _selftest_release, (uintptr_t)&release };
+	gate.io.offset = 0U;
+	gate.open = 0U;
+	if (mpatch_encode_async(&release.job, &enc_param, &release_completion) != MPATCH_SUCCESS)
+	{
+		TEST_FAIL("Failed to start the job!");
+	}
+	set_cancelled(&gate.open);
+	while (!is_cancelled(&release.done))
+	{
+		/*wait for the completion handler*/
+	}
+	if ((release.result != MPATCH_SUCCESS) || release.job)
+	{
+		TEST_FAIL("Failed to destroy the job from the completion handler!");
+	}
+
+	//Clean-up memory
+	_selftest_fixture_free(&fixture);
+}
+
+static void selftest_thread_pool(void)
+{
+	static const uint_fast32_t TASK_COUNT = 300U, TASK_DEPTH = 2U, NODE_COUNT = 21U, ROUND_COUNT = 8U;
+
+	//Allocate buffers
+	selftest_task_t *const tasks = (selftest_task_t*)malloc(TASK_COUNT * sizeof(selftest_task_t));
+	pool_task_t *const task_queue = (pool_task_t*)malloc(TASK_COUNT * sizeof(pool_task_t));
+	if (!(tasks && task_queue))
+	{
+		TEST_FAIL("Memory allocation has failed!");
+	}
+
+	//Run nested tasks, more than fit into a deque (the pinned pool assigns them to threads), several rounds on the same
+	//pool, so that the deque slots wrap around and get overwritten while thieves may still be reading them
+	static const uint32_t THREAD_COUNT[3U] = { 1U, 4U, 40U };
+	for (uint32_t k = 0U; k < 3U; ++k)
+	{
+		thread_pool_t *thread_pool = NULL;
+		if (!mpatch_pool_create(&thread_pool, THREAD_COUNT[k], BOOLIFY(k & 1U)))
+		{
+			TEST_FAIL("Failed to create thread pool!");
+		}
+		for (uint_fast32_t round = 0U; round < ROUND_COUNT; ++round)
+		{
+			for (uint_fast32_t i = 0U; i < TASK_COUNT; ++i)
+			{
+				tasks[i].thread_pool = thread_pool;
+				tasks[i].depth = TASK_DEPTH;
+				tasks[i].node_count = 0U;
+				task_queue[i].func = _selftest_task;
+				task_queue[i].data = (uintptr_t)&tasks[i];
+			}
+			if (thread_pool->pinned)
+			{
+				mpatch_pool_exec_affine(thread_pool, task_queue, TASK_COUNT);
+			}
+			else
+			{
+				mpatch_pool_exec(thread_pool, task_queue, TASK_COUNT);
+			}
+			for (uint_fast32_t i = 0U; i < TASK_COUNT; ++i)
+			{
+				if (tasks[i].node_count != NODE_COUNT)
+				{
+					TEST_FAIL("Not all tasks have been executed!");
+				}
+			}
+		}
+		if (!mpatch_pool_destroy(&thread_pool))
+		{
+			TEST_FAIL("Failed to destroy thread pool!");
+		}
+	}
+
+	//Clean-up memory
+	free(tasks);
+	free(task_queue);
+}
+
+static void selftest_search_split(void)
+{
+	static const uint_fast32_t RANGE_LEN[3U] = { 8192U, 65536U, 1048576U }, EXPECTED[3U] = { 1U, 4U, 8U };
+
+	//Fixed cost model: 1 ns per byte, 10 us + 4 us per task to dispatch
+	thread_pool_t thread_pool;
+	thread_pool.thread_count = 8U;
+	thread_pool.dispatch_base = 10000U;
+	thread_pool.dispatch_step = 4000U;
+	search_state_t search_state;
+	memset(&search_state, 0, sizeof(search_state_t));
+	search_state.model.byte_cost = 1.0;
+
+	//Small searches stay serial, large ones use all threads
+	for (uint_fast32_t i = 0U; i < 3U; ++i)
+	{
+		if (plan_search_split(&search_state, &thread_pool, 0U, RANGE_LEN[i]) != EXPECTED[i])
+		{
+			TEST_FAIL("Unexpected search split!");
+		}
+	}
+}
+
+static void selftest_search_index(void)
+{
+	static const uint_fast32_t REFERENCE_SIZE = 1048576U, BUDGET = 262144U, PIECE_COUNT = 1024U;
+
+	//Index a random reference with the smallest budget, so the table is half full and the window limit is low
+	uint8_t *const reference = (uint8_t*)malloc(REFERENCE_SIZE * sizeof(uint8_t));
+	if (!reference)
+	{
+		TEST_FAIL("Memory allocation has failed!");
+	}
+	srand(5381);
+	for (uint_fast32_t i = 0U; i < REFERENCE_SIZE; ++i)
+	{
+		reference[i] = (uint8_t)rand();
+	}
+	fp_index_t index;
+	fp_range_t *ranges = NULL;
+	if (!(fp_index_init(&index, reference, REFERENCE_SIZE, BUDGET, true, NULL) && (ranges = (fp_range_t*)malloc(index.max_ranges * sizeof(fp_range_t)))))
+	{
+		TEST_FAIL("Failed to create the index!");
+	}
+
+	//Every piece is just long enough to cover a sample, so each one must get a window that contains it
+	const uint64_t piece_size = index.stride + FP_LENGTH + 1U;
+	for (uint_fast32_t p = 0U; p < PIECE_COUNT; ++p)
+	{
+		const uint64_t offset = index.anchor_window + ((((uint_fast32_t)rand() << 15U) ^ (uint_fast32_t)rand()) % (REFERENCE_SIZE - index.anchor_window - piece_size));
+		const uint_fast32_t count = fp_select_ranges(&index, ranges, reference + offset, piece_size, 0U, 0U, REFERENCE_SIZE);
+		bool found = false;
+		for (uint_fast32_t r = 0U; r < count; ++r)
+		{
+			found = found || ((ranges[r].begin <= offset) && (offset < ranges[r].end));
+		}
+		if (!found)
+		{
+			TEST_FAIL("Fingerprint index has missed a piece!");
+		}
+	}
+
+	//Clean-up memory
+	fp_index_free(&index);
+	free(ranges);
+	free(reference);
+}
+
+void mpatch_selftest()
+{
+	selftest_thread_pool();
+	selftest_search_split();
+	selftest_search_index();
+	selftest_bit_iofunc();
+	selftest_exp_golomb();
+	selftest_bit_crc32c();
+	selftest_bit_md5dig();
+	selftest_bit_digest();
+	selftest_codec_roundtrip();
+	selftest_patch_roundtrip();
+	selftest_patch_in_place();
+	selftest_patch_segmented();
+	selftest_patch_streamed();
+	selftest_patch_windowed();
+	selftest_patch_async();
+}
+
+/* ======================================================================= */
+/* Benchmark                                                               */
+/* ======================================================================= */
+
+#define BENCH_SINK_SIZE 1048576U
+#define BENCH_ROUNDS 16777216U
+
+static bool _benchmark_writer(const uint8_t *const data, const uint32_t size, const uintptr_t user_data)
+{
+	selftest_io_t *const io = (selftest_io_t*)user_data;
+	if (io->capacity - io->offset < size)
+	{
+		io->offset = 0U; /*wrap around*/
+	}
+	memcpy(io->buffer + io->offset, data, size);
+	io->offset += size;
+	return true;
+}
+
+static void _benchmark_report(const char *const name, const uint64_t total_bytes, const clock_t total_ticks)
+{
+	const double seconds = (double)((total_ticks > 0) ? total_ticks : 1) / CLOCKS_PER_SEC;
+	fprintf(stderr, "%-24s %10.1f MB/s\n", name, (total_bytes / seconds) / 1048576.0);
+}
+
+static void _benchmark_report_time(const char *const name, const uint64_t total_bytes, const double seconds)
+{
+	fprintf(stderr, "%-24s %10.1f MB/s (%.1f s)\n", name, (total_bytes / seconds) / 1048576.0, seconds);
+}
+
+static void benchmark_bit_writer(void)
+{
+	//Init I/O routines
+	selftest_io_t io = { NULL, BENCH_SINK_SIZE, 0U };
+	io_state_t *const wr_state = (io_state_t*)malloc(sizeof(io_state_t));
+	uint8_t *const literal = (uint8_t*)malloc(2048U * sizeof(uint8_t));
+	if (!((io.buffer = (uint8_t*)malloc(io.capacity * sizeof(uint8_t))) && wr_state && literal))
+	{
+		TEST_FAIL("Memory allocation has failed!");
+	}
+	const mpatch_writer_t writer = { _benchmark_writer, (uintptr_t)&io };
+
+	//Generate test data
+	srand(666);
+	for (uint_fast32_t i = 0U; i < 2048U; ++i)
+	{
+		literal[i] = (uint8_t)rand();
+	}
+
+	//Single bits
+	init_io_state(wr_state);
+	clock_t clock_begin = clock();
+	for (uint_fast32_t i = 0U; i < BENCH_ROUNDS; ++i)
+	{
+		if (!write_bit(((uint32_t)(i * 0x9E3779B9U)) >> 31U, &writer, wr_state))
+		{
+			TEST_FAIL("Failed to write bit!");
+		}
+	}
+	flush_state(&writer, wr_state);
+	_benchmark_report("write_bit", wr_state->byte_counter, clock() - clock_begin);
+
+	//Exp-Golomb codes
+	init_io_state(wr_state);
+	clock_begin = clock();
+	for (uint_fast32_t i = 0U; i < BENCH_ROUNDS / 4U; ++i)
+	{
+		if (!exp_golomb_write(((uint32_t)(i * 0x9E3779B9U)) >> (20U + (i & 7U)), &writer, wr_state))
+		{
+			TEST_FAIL("Failed to write number!");
+		}
+	}
+	flush_state(&writer, wr_state);
+	_benchmark_report("exp_golomb_write", wr_state->byte_counter, clock() - clock_begin);
+
+	//Literal bytes (unaligned)
+	init_io_state(wr_state);
+	clock_begin = clock();
+	for (uint_fast32_t i = 0U; i < BENCH_ROUNDS / 256U; ++i)
+	{
+		if (!(write_bit(true, &writer, wr_state) && write_bytes(literal, 1U + (i & 2047U), &writer, wr_state)))
+		{
+			TEST_FAIL("Failed to write bytes!");
+		}
+	}
+	flush_state(&writer, wr_state);
+	_benchmark_report("write_bytes", wr_state->byte_counter, clock() - clock_begin);
+
+	//Clean-up memory
+	free(literal);
+	free(wr_state);
+	free(io.buffer);
+}
+
+static void benchmark_exp_golomb(void)
+{
+	static const uint_fast32_t VALUE_COUNT = BENCH_ROUNDS / 4U;
+
+	//Init I/O routines
+	selftest_io_t io = { NULL, 4U * VALUE_COUNT * sizeof(uint32_t), 0U };
+	io_state_t *const io_state = (io_state_t*)malloc(sizeof(io_state_t));
+	if (!((io.buffer = (uint8_t*)malloc(io.capacity * sizeof(uint8_t))) && io_state))
+	{
+		TEST_FAIL("Memory allocation has failed!");
+	}
+
+	//Write numbers
+	const mpatch_writer_t writer = { _selftest_writer, (uintptr_t)&io };
+	init_io_state(io_state);
+	for (uint_fast32_t i = 0U; i < VALUE_COUNT; ++i)
+	{
+		if (!exp_golomb_write(((uint32_t)(i * 0x9E3779B9U)) >> (20U + (i & 7U)), &writer, io_state))
+		{
+			TEST_FAIL("Failed to write number!");
+		}
+	}
+	flush_state(&writer, io_state);
+
+	//Read numbers (via reader function, then from memory)
+	const mpatch_reader_t reader = { _selftest_reader, (uintptr_t)&io }, no_reader = { NULL, 0U };
+	const uint_fast32_t total_bytes = io.offset;
+	for (uint_fast32_t k = 0U; k < 2U; ++k)
+	{
+		io.capacity = total_bytes;
+		io.offset = 0U;
+		init_io_state(io_state);
+		if (k)
+		{
+			set_input_buffer(io_state, io.buffer, total_bytes);
+		}
+		const clock_t clock_begin = clock();
+		for (uint_fast32_t i = 0U; i < VALUE_COUNT; ++i)
+		{
+			uint64_t value;
+			if (!exp_golomb_read(&value, k ? &no_reader : &reader, io_state))
+			{
+				TEST_FAIL("Failed to read number!");
+			}
+			if (value != (((uint32_t)(i * 0x9E3779B9U)) >> (20U + (i & 7U))))
+			{
+				TEST_FAIL("Data validation has failed!");
+			}
+		}
+		_benchmark_report(k ? "exp_golomb_read (memory)" : "exp_golomb_read", total_bytes, clock() - clock_begin);
+	}
+
+	//Clean-up memory
+	free(io_state);
+	free(io.buffer);
+}
+
+static void _benchmark_task(const uintptr_t user_data)
+{
+	(void)user_data; /*empty task*/
+}
+
+static double _benchmark_clock(void)
+{
+	struct timespec now;
+	if (!timespec_get(&now, TIME_UTC))
+	{
+		TEST_FAIL("Failed to read the clock!");
+	}
+	return (double)now.tv_sec + (now.tv_nsec / 1000000000.0);
+}
+
+static void benchmark_thread_pool(void)
+{
+	static const uint_fast32_t ROUNDS = BENCH_ROUNDS / 256U;
+	static const uint32_t MAX_THREADS = 128U;
+	pool_task_t *const tasks = (pool_task_t*)malloc(MAX_THREADS * sizeof(pool_task_t));
+	if (!tasks)
+	{
+		TEST_FAIL("Memory allocation has failed!");
+	}
+
+	for (uint32_t i = 0U; i < MAX_THREADS; ++i)
+	{
+		tasks[i].func = _benchmark_task;
+		tasks[i].data = (uintptr_t)i;
+	}
+
+	//Measure the round-trip latency of a fork-join of empty tasks, one task per thread
+	for (uint32_t thread_count = 1U; thread_count <= MAX_THREADS; thread_count <<= 1)
+	{
+		thread_pool_t *pool;
+		if (!mpatch_pool_create(&pool, thread_count, false))
+		{
+			TEST_FAIL("Failed to create thread pool!");
+		}
+		mpatch_pool_exec(pool, tasks, pool->thread_count); /*warm-up*/
+		const double time_begin = _benchmark_clock();
+		for (uint_fast32_t i = 0U; i < ROUNDS; ++i)
+		{
+			mpatch_pool_exec(pool, tasks, pool->thread_count);
+		}
+		const double elapsed = _benchmark_clock() - time_begin;
+		fprintf(stderr, "pool_exec (%3u threads)   %10.2f us\n", pool->thread_count, (elapsed * 1000000.0) / ROUNDS);
+		if (!mpatch_pool_destroy(&pool))
+		{
+			TEST_FAIL("Failed to destroy thread pool!");
+		}
+	}
+
+	free(tasks);
+}
+
+/*
+ * To compare one NUMA node with two, run e.g. "numactl --cpunodebind=0 --membind=0" and "numactl --cpunodebind=0,1"
+ */
+static void benchmark_search_placement(void)
+{
+	static const uint_fast32_t HAYSTACK_SIZE = 64U * 1048576U, NEEDLE_SIZE = 64U, ROUNDS = 4U;
+	static const uint32_t MAX_THREADS = 32U;
+
+	//Generate random haystack and needle
+	uint8_t *const haystack = (uint8_t*)malloc(HAYSTACK_SIZE * sizeof(uint8_t));
+	if (!haystack)
+	{
+		TEST_FAIL("Memory allocation has failed!");
+	}
+	srand(1337);
+	for (uint_fast32_t i = 0U; i < HAYSTACK_SIZE; ++i)
+	{
+		haystack[i] = (uint8_t)rand();
+	}
+
+	//Search with shared and with node-local (pinned) haystack; the shared haystack was first touched by this thread, so
+	//it lives on a single node. Compare on a multi-node machine with the default "first touch" policy, restricted to two
+	//nodes, e.g. "numactl --cpunodebind=0,1 --localalloc mpatch --benchmark" (do NOT use "--interleave", because then
+	//the placed copy gets interleaved too). The pinned workers only use the processors of those nodes.
+	for (uint32_t pinned = 0U; pinned < 2U; ++pinned)
+	{
+		for (uint32_t thread_count = 1U; thread_count <= MAX_THREADS; thread_count <<= 1)
+		{
+			thread_pool_t *pool;
+			if (!mpatch_pool_create(&pool, thread_count, BOOLIFY(pinned)))
+			{
+				TEST_FAIL("Failed to create thread pool!");
+			}
+			const uint8_t *const local_haystack = pinned ? place_haystack(pool, haystack, HAYSTACK_SIZE) : haystack;
+			if (!local_haystack)
+			{
+				TEST_FAIL("Memory allocation has failed!");
+			}
+			search_state_t search_state;
+			memset(&search_state, 0, sizeof(search_state_t));
+			substring_t substring;
+			const double time_begin = _benchmark_clock();
+			for (uint_fast32_t i = 0U; i < ROUNDS; ++i)
+			{
+				find_optimal_substring(&substring, 0U, pool, &search_state, haystack + (i * NEEDLE_SIZE), NEEDLE_SIZE, local_haystack, 0U, HAYSTACK_SIZE);
+			}
+			const double elapsed = _benchmark_clock() - time_begin;
+			fprintf(stderr, "search (%2u threads%s) %8.1f MB/s\n", pool->thread_count, pinned ? ", local" : ", shared", ((double)HAYSTACK_SIZE * ROUNDS) / (elapsed * 1048576.0));
+			free_search_state(&search_state);
+			if (local_haystack != haystack)
+			{
+				free((void*)local_haystack);
+			}
+			if (!mpatch_pool_destroy(&pool))
+			{
+				TEST_FAIL("Failed to destroy thread pool!");
+			}
+		}
+	}
+
+	free(haystack);
+}
+
+static void benchmark_cancellation(void)
+{
+	static const uint_fast32_t DATA_SIZE = 16U * 1048576U;
+	static const double RUN_TIME = 0.25;
+
+	//Generate unrelated message and reference, so that every search scans the whole reference
+	uint8_t *const reference = (uint8_t*)malloc(DATA_SIZE * sizeof(uint8_t));
+	uint8_t *const message = (uint8_t*)malloc(DATA_SIZE * sizeof(uint8_t));
+	selftest_io_t io = { NULL, BENCH_SINK_SIZE, 0U };
+	if (!((io.buffer = (uint8_t*)malloc(io.capacity * sizeof(uint8_t))) && reference && message))
+	{
+		TEST_FAIL("Memory allocation has failed!");
+	}
+	srand(4242);
+	for (uint_fast32_t i = 0U; i < DATA_SIZE; ++i)
+	{
+		reference[i] = (uint8_t)rand();
+		message[i] = (uint8_t)rand();
+	}
+
+	//Let the encoder run for a while, then measure how long it takes to stop
+	mpatch_enc_param_t enc_param;
+	memset(&enc_param, 0, sizeof(mpatch_enc_param_t));
+	enc_param.message_in.buffer = message;
+	enc_param.message_in.capacity = DATA_SIZE;
+	enc_param.reference_in.buffer = reference;
+	enc_param.reference_in.capacity = DATA_SIZE;
+	enc_param.compressed_out.writer_func = _benchmark_writer;
+	enc_param.compressed_out.user_data = (uintptr_t)&io;
+	mpatch_job_t *job = NULL;
+	if (mpatch_encode_async(&job, &enc_param, NULL) != MPATCH_SUCCESS)
+	{
+		TEST_FAIL("Failed to start the job!");
+	}
+	const double time_start = _benchmark_clock();
+	while ((_benchmark_clock() - time_start < RUN_TIME) && (!mpatch_job_poll(job, NULL)))
+	{
+		/*busy wait*/
+	}
+	const double time_cancel = _benchmark_clock();
+	mpatch_job_cancel(job);
+	const mpatch_error_t result = mpatch_job_wait(job);
+	fprintf(stderr, "%-24s %10.3f ms%s\n", "cancel latency", (_benchmark_clock() - time_cancel) * 1000.0, (result == MPATCH_CANCELLED_BY_USER) ? "" : " (job had finished)");
+	mpatch_job_destroy(&job);
+
+	free(reference);
+	free(message);
+	free(io.buffer);
+}
+
+static void _benchmark_pattern(uint8_t *const data, const uint64_t offset, const size_t size)
+{
+	//Pseudo-random bytes that can be reproduced at any offset, so that a huge reference need not be kept in memory
+	for (size_t i = 0U; i < size; ++i)
+	{
+		const uint64_t pos = offset + i;
+		uint64_t value = (pos >> 3) * 0x9E3779B97F4A7C15ULL;
+		value ^= value >> 29;
+		data[i] = (uint8_t)(value >> ((pos & 7U) * 8U));
+	}
+}
+
+static bool _benchmark_accessor(uint8_t *const data, const uint64_t offset, const uint32_t size, const uintptr_t user_data)
+{
+	uint32_t *const max_size = (uint32_t*)user_data;
+	*max_size = (uint32_t)max_uint64(*max_size, size);
+	_benchmark_pattern(data, offset, size);
+	return true;
+}
+
+static void benchmark_large_reference(void)
+{
+	static const uint64_t SKIP_SIZE = 1048576U;
+	static const uint64_t DATA_SIZE = UINT32_MAX + 2097152ULL;
+
+	if (SIZE_MAX <= UINT32_MAX)
+	{
+		fprintf(stderr, "%-24s %13s\n", "large reference", "(skipped)");
+		return;
+	}
+
+	//The message is a single run of the reference, starting at "SKIP_SIZE", so its only substring ends beyond 4 GiB and is longer than UINT32_MAX
+	const size_t reference_size = (size_t)(SKIP_SIZE + DATA_SIZE + SKIP_SIZE);
+	uint8_t *const reference = (uint8_t*)malloc(reference_size * sizeof(uint8_t));
+	selftest_io_t io = { NULL, BENCH_SINK_SIZE, 0U };
+	if (!((io.buffer = (uint8_t*)malloc(io.capacity * sizeof(uint8_t))) && reference))
+	{
+		TEST_FAIL("Memory allocation has failed!");
+	}
+	_benchmark_pattern(reference, 0U, reference_size);
+
+	//Encode, the message aliases the reference
+	mpatch_enc_param_t enc_param;
+	memset(&enc_param, 0, sizeof(mpatch_enc_param_t));
+	enc_param.message_in.buffer = reference + SKIP_SIZE;
+	enc_param.message_in.capacity = DATA_SIZE;
+	enc_param.reference_in.buffer = reference;
+	enc_param.reference_in.capacity = reference_size;
+	enc_param.compressed_out.writer_func = _selftest_writer;
+	enc_param.compressed_out.user_data = (uintptr_t)&io;
+	const double time_encode = _benchmark_clock();
+	if (mpatch_encode(&enc_param) != MPATCH_SUCCESS)
+	{
+		TEST_FAIL("Failed to encode the patch!");
+	}
+	_benchmark_report_time("large reference (enc)", DATA_SIZE, _benchmark_clock() - time_encode);
+
+	//Decode, the reference is read through an accessor, and the output reuses the reference's memory
+	uint32_t max_size = 0U;
+	mpatch_dec_param_t dec_param;
+	memset(&dec_param, 0, sizeof(mpatch_dec_param_t));
+	dec_param.compressed_buf.buffer = io.buffer;
+	dec_param.compressed_buf.capacity = io.offset;
+	dec_param.reference_acc.accessor_func = _benchmark_accessor;
+	dec_param.reference_acc.length = reference_size;
+	dec_param.reference_acc.user_data = (uintptr_t)&max_size;
+	dec_param.message_out.buffer = reference;
+	dec_param.message_out.capacity = DATA_SIZE;
+	memset(reference, 0, (size_t)DATA_SIZE);
+	const double time_decode = _benchmark_clock();
+	if (mpatch_decode(&dec_param) != MPATCH_SUCCESS)
+	{
+		TEST_FAIL("Failed to decode the patch!");
+	}
+	_benchmark_report_time("large reference (dec)", DATA_SIZE, _benchmark_clock() - time_decode);
+
+	//Validate the output, and that the substring was read in pieces of at most UINT32_MAX
+	if (max_size != UINT32_MAX)
+	{
+		TEST_FAIL("Substring was not split at UINT32_MAX!");
+	}
+	uint8_t *const expected = io.buffer;
+	for (uint64_t offset = 0U; offset < DATA_SIZE; offset += BENCH_SINK_SIZE)
+	{
+		const size_t len = (size_t)min_uint64(DATA_SIZE - offset, BENCH_SINK_SIZE);
+		_benchmark_pattern(expected, SKIP_SIZE + offset, len);
+		if (memcmp(reference + offset, expected, len))
+		{
+			TEST_FAIL("Data validation has failed!");
+		}
+	}
+
+	free(reference);
+	free(io.buffer);
+}
+
+void mpatch_benchmark()
+{
+	benchmark_bit_writer();
+	benchmark_exp_golomb();
+	benchmark_thread_pool();
+	benchmark_search_placement();
+	benchmark_cancellation();
+	benchmark_large_reference();
 }
@@ -24,6 +24,7 @@
 #include "utils.h"
 #include "bit_io.h"
 #include "pool.h"
+#include "fingerprint.h"
 #include <float.h>
 
 #include <stdlib.h>
@@ -33,29 +34,30 @@
 
 typedef struct
 {
-	uint_fast32_t length;
-	uint_fast32_t offset_diff;
+	uint64_t length;
+	uint64_t offset_diff;
 	bool offset_sign;
 }
 substring_t;
 
 typedef struct
 {
-	uint_fast32_t prev_offset;
+	uint64_t prev_offset;
 	const uint8_t *needle;
-	uint_fast32_t needle_len;
+	uint64_t needle_len;
 	const uint8_t *haystack;
-	uint_fast32_t haystack_len;
+	uint64_t haystack_len;
+	const cancel_token_t *cancel;
 }
 search_param_t;
 
-typedef struct
+typedef struct CACHE_ALIGN
 {
 	const search_param_t *search_param;
 	struct
 	{
-		uint_fast32_t begin;
-		uint_fast32_t end;
+		uint64_t begin;
+		uint64_t end;
 	}
 	search_range;
 	struct
@@ -64,12 +66,47 @@ typedef struct
 		uint64_t score;
 	}
 	result;
+	uint64_t candidates;
 }
 search_thread_t;
 
+#define SPLIT_BUCKETS 16U
+
+typedef struct
+{
+	search_thread_t *thread_param;
+	pool_task_t *task_queue;
+	uint_fast32_t capacity;
+	const cancel_token_t *cancel; /*optional, searches stop early once it is set*/
+	uint_fast32_t window; /*if non-zero, only a window of this size around the previous offset is searched*/
+	const fp_index_t *index; /*optional, only the windows selected by the fingerprint index are searched*/
+	fp_range_t *ranges;
+	struct
+	{
+		const uint8_t *haystack;
+		double byte_cost;
+		double candidate_cost;
+		double candidate_rate[256U];
+	}
+	model;
+	uint_fast32_t split_hist[SPLIT_BUCKETS];
+}
+search_state_t;
+
+/*
+ * Whether (and how widely) a search is split across the thread pool is decided by a simple cost model: the serial cost
+ * of a search is estimated as "bytes * byte_cost + candidates * candidate_cost", where "byte_cost" is calibrated with
+ * memchr() on a sample of the haystack, "candidates" is estimated from the frequency of the needle's first byte in that
+ * sample, and "candidate_cost" is learned from the searches performed so far. Splitting the search into N ranges costs
+ * the measured dispatch time of the pool plus 1/N of the serial cost.
+ */
+#define MODEL_BLOCK_SIZE 4096U
+#define MODEL_BLOCK_COUNT 64U
+#define MIN_SPLIT_LEN 4096U
+
 #define SUBSTRING_THRESHOLD 3U
 
-static __forceinline uint64_t substring_score(const uint_fast32_t length, const uint_fast32_t offset_diff)
+static __forceinline uint64_t substring_score(const uint64_t length, const uint64_t offset_diff)
 {
 	const uint64_t offset_bits = exp_golomb_size(offset_diff);
 	const uint64_t data_bits = (uint64_t)length << 3U;
@@ -82,16 +119,17 @@ static inline uintptr_t _find_optimal_substring(const uintptr_t data)
 
 	//Get search parameters
 	const uint8_t *const haystack_ptr = param->search_param->haystack;
-	const uint_fast32_t  haystack_len = param->search_param->haystack_len;
+	const uint64_t       haystack_len = param->search_param->haystack_len;
 	const uint8_t *const needle_ptr   = param->search_param->needle;
-	const uint_fast32_t  needle_len   = param->search_param->needle_len;
-	const uint_fast32_t  range_begin  = param->search_range.begin;
-	const uint_fast32_t  range_end    = param->search_range.end;
-	const uint_fast32_t  prev_offset  = param->search_param->prev_offset;
+	const uint64_t       needle_len   = param->search_param->needle_len;
+	const uint64_t       range_begin  = param->search_range.begin;
+	const uint64_t       range_end    = param->search_range.end;
+	const uint64_t       prev_offset  = param->search_param->prev_offset;
 
 	//Initialize result
 	memset(&param->result.data, 0, sizeof(substring_t));
 	param->result.score = 0U;
+	param->candidates = 0U;
 
 	//Sanity checking
 	if ((haystack_len < 2U) || (needle_len < 2U))
@@ -99,106 +137,376 @@ static inline uintptr_t _find_optimal_substring(const uintptr_t data)
 		return 0U;
 	}
 
-	//Setup search parameters
-	const uint8_t *haystack_off = haystack_ptr + range_begin;
-	uint_fast32_t remaining = range_end - range_begin;
-
-	//Find the longest substring in haystack
-	while (haystack_off = memchr(haystack_off, *needle_ptr, remaining))
+	//Find the longest substring in haystack (the range is scanned in windows, so that cancellation is noticed in time)
+	const cancel_token_t *const cancel = param->search_param->cancel;
+	uint64_t candidates = 0U;
+	for (uint64_t window_begin = range_begin; (window_begin < range_end) && (!is_cancelled(cancel));)
 	{
-		const uint_fast32_t offset_curr = (uint_fast32_t)(haystack_off - haystack_ptr);
-		const uint_fast32_t match_limit = min_uint32(needle_len, haystack_len - offset_curr);
-		if ((match_limit > SUBSTRING_THRESHOLD) && (!memcmp(haystack_off, needle_ptr, SUBSTRING_THRESHOLD + 1U)))
+		const uint_fast32_t window_len = (uint_fast32_t)min_uint64(CANCEL_POLL_SIZE, range_end - window_begin);
+		const uint8_t *const window_end = haystack_ptr + window_begin + window_len;
+		const uint8_t *haystack_off = haystack_ptr + window_begin;
+		while ((haystack_off = memchr(haystack_off, *needle_ptr, (size_t)(window_end - haystack_off))) != NULL)
 		{
-			uint_fast32_t matching_len;
-			for (matching_len = SUBSTRING_THRESHOLD + 1U; matching_len < match_limit; matching_len++)
+			++candidates;
+			const uint64_t offset_curr = (uint64_t)(haystack_off - haystack_ptr);
+			const uint64_t match_limit = min_uint64(needle_len, haystack_len - offset_curr);
+			if ((match_limit > SUBSTRING_THRESHOLD) && (!memcmp(haystack_off, needle_ptr, SUBSTRING_THRESHOLD + 1U)))
 			{
-				if (haystack_off[matching_len] != needle_ptr[matching_len])
+				uint64_t matching_len;
+				for (matching_len = SUBSTRING_THRESHOLD + 1U; matching_len < match_limit; matching_len++)
+				{
+					if (haystack_off[matching_len] != needle_ptr[matching_len])
+					{
+						break; /*end of matching sequence*/
+					}
+				}
+				const uint64_t offset_diff = diff_uint64(offset_curr, prev_offset);
+				const uint64_t score = substring_score(matching_len, offset_diff);
+				if (score > param->result.score)
 				{
-					break; /*end of matching sequence*/
+					param->result.data.length = matching_len;
+					param->result.data.offset_diff = offset_diff;
+					param->result.data.offset_sign = (offset_curr >= prev_offset) ? SUBSTR_FWD : SUBSTR_BWD;
+					param->result.score = score;
 				}
 			}
-			const uint_fast32_t offset_diff = diff_uint32(offset_curr, prev_offset);
-			const uint64_t score = substring_score(matching_len, offset_diff);
-			if (score > param->result.score)
+			++haystack_off;
+		}
+		window_begin += window_len;
+	}
+
+	param->candidates = candidates;
+	return 1U;
+}
+
+static inline bool reserve_search_state(search_state_t *const search_state, const uint_fast32_t thread_count)
+{
+	if (search_state->capacity >= thread_count)
+	{
+		return true;
+	}
+	free_aligned(search_state->thread_param);
+	free(search_state->task_queue);
+	search_state->capacity = 0U;
+	search_state->thread_param = (search_thread_t*)calloc_aligned(thread_count, sizeof(search_thread_t));
+	search_state->task_queue = (pool_task_t*)calloc(thread_count, sizeof(pool_task_t));
+	if (!(search_state->thread_param && search_state->task_queue))
+	{
+		return false;
+	}
+	search_state->capacity = thread_count;
+	return true;
+}
+
+static inline bool attach_search_index(search_state_t *const search_state, const fp_index_t *const index)
+{
+	search_state->index = index;
+	return BOOLIFY(search_state->ranges = (fp_range_t*)malloc(index->max_ranges * sizeof(fp_range_t)));
+}
+
+static inline uint64_t search_state_memory(const search_state_t *const search_state)
+{
+	return (search_state->capacity * (sizeof(search_thread_t) + sizeof(pool_task_t))) + ((search_state->index && search_state->ranges) ? (search_state->index->max_ranges * sizeof(fp_range_t)) : 0U);
+}
+
+static inline void free_search_state(search_state_t *const search_state)
+{
+	free_aligned(search_state->thread_param);
+	free(search_state->task_queue);
+	free(search_state->ranges);
+	memset(search_state, 0, sizeof(search_state_t));
+}
+
+static inline void reduce_search_results(search_thread_t *const thread_param, const uint_fast32_t count)
+{
+	//Pairwise reduction, on a tie the lower range wins (just like with a linear scan)
+	for (uint_fast32_t stride = 1U; stride < count; stride <<= 1U)
+	{
+		for (uint_fast32_t t = 0U; t + stride < count; t += (stride << 1U))
+		{
+			if (thread_param[t + stride].result.score > thread_param[t].result.score)
 			{
-				param->result.data.length = matching_len;
-				param->result.data.offset_diff = offset_diff;
-				param->result.data.offset_sign = (offset_curr >= prev_offset) ? SUBSTR_FWD : SUBSTR_BWD;
-				param->result.score = score;
+				memcpy(&thread_param[t].result, &thread_param[t + stride].result, sizeof(thread_param[t].result));
 			}
 		}
-		if (offset_curr < range_end)
+	}
+}
+
+static inline void calibrate_search_model(search_state_t *const search_state, const uint8_t *const haystack, const uint64_t haystack_len)
+{
+	//Sample the haystack in evenly spaced blocks
+	uint_fast32_t hist[256U], sample_len = 0U;
+	memset(hist, 0, sizeof(hist));
+	const uint64_t block_step = (haystack_len / MODEL_BLOCK_COUNT > MODEL_BLOCK_SIZE) ? (haystack_len / MODEL_BLOCK_COUNT) : MODEL_BLOCK_SIZE;
+	for (uint64_t offset = 0U; offset < haystack_len; offset += block_step)
+	{
+		const uint_fast32_t block_len = (uint_fast32_t)min_uint64(MODEL_BLOCK_SIZE, haystack_len - offset);
+		for (uint_fast32_t i = 0U; i < block_len; ++i)
 		{
-			++haystack_off;
-			remaining = range_end - offset_curr;
+			hist[haystack[offset + i]]++;
 		}
-		else
+		sample_len += block_len;
+	}
+
+	//Estimate the number of candidates per byte, for each possible first byte of the needle
+	uint_fast32_t rarest = 0U;
+	for (uint_fast32_t i = 0U; i < 256U; ++i)
+	{
+		search_state->model.candidate_rate[i] = (double)hist[i] / sample_len;
+		if (hist[i] < hist[rarest])
 		{
-			break; /*end of range*/
+			rarest = i;
 		}
 	}
 
-	return 1U;
+	//Measure the cost of scanning the sample for its rarest byte
+	const uint64_t time_begin = mpatch_pool_clock();
+	for (uint64_t offset = 0U; offset < haystack_len; offset += block_step)
+	{
+		const uint8_t *ptr = haystack + offset, *const block_end = ptr + min_uint64(MODEL_BLOCK_SIZE, haystack_len - offset);
+		while ((ptr = (const uint8_t*)memchr(ptr, (int)rarest, (size_t)(block_end - ptr))) != NULL)
+		{
+			if (++ptr >= block_end)
+			{
+				break;
+			}
+		}
+	}
+	search_state->model.byte_cost = (double)(mpatch_pool_clock() - time_begin) / sample_len;
+	search_state->model.candidate_cost = 32.0 * search_state->model.byte_cost; /*initial guess, refined by measurements*/
+	search_state->model.haystack = haystack;
 }
 
-static inline uint64_t find_optimal_substring(substring_t *const substring, const uint_fast32_t prev_offset, thread_pool_t *const thread_pool, const uint8_t *const needle, const uint_fast32_t needle_len, const uint8_t *const haystack, const uint_fast32_t haystack_len)
+static inline uint_fast32_t plan_search_split(search_state_t *const search_state, const thread_pool_t *const thread_pool, const uint8_t first_byte, const uint64_t range_len)
 {
-	//Common search parameters
-	const search_param_t search_param = { prev_offset, needle, needle_len, haystack, haystack_len };
+	//Estimate the serial cost
+	const double serial_cost = range_len * (search_state->model.byte_cost + (search_state->model.candidate_rate[first_byte] * search_state->model.candidate_cost));
 
-	//Initialize result
-	memset(substring, 0, sizeof(substring_t));
+	//Find the number of ranges with the lowest estimated cost
+	const uint_fast32_t max_split = (uint_fast32_t)min_uint64(thread_pool->thread_count, range_len / MIN_SPLIT_LEN);
+	uint_fast32_t best_split = 1U;
+	double best_cost = serial_cost;
+	for (uint_fast32_t split = 2U; split <= max_split; ++split)
+	{
+		const double cost = (double)thread_pool->dispatch_base + ((double)thread_pool->dispatch_step * (split - 2U)) + (serial_cost / split);
+		if (cost < best_cost)
+		{
+			best_split = split;
+			best_cost = cost;
+		}
+	}
+	return best_split;
+}
+
+static inline void update_search_model(search_state_t *const search_state, const thread_pool_t *const thread_pool, const uint_fast32_t split, const uint64_t range_len, const uint64_t candidates, const uint64_t elapsed)
+{
+	//Convert the elapsed time into the equivalent serial time
+	double serial_time = (double)elapsed;
+	if (split > 1U)
+	{
+		const double dispatch_cost = (double)thread_pool->dispatch_base + ((double)thread_pool->dispatch_step * (split - 2U));
+		serial_time = (serial_time > dispatch_cost) ? ((serial_time - dispatch_cost) * split) : 0.0;
+	}
 
-	//Set up per-thread parameters
-	search_thread_t thread_param[MAX_THREAD_COUNT];
-	memset(thread_param, 0, sizeof(thread_param));
+	//Update the cost per candidate (moving average)
+	if (candidates > 0U)
+	{
+		const double scan_time = range_len * search_state->model.byte_cost;
+		const double candidate_cost = (serial_time > scan_time) ? ((serial_time - scan_time) / candidates) : 0.0;
+		search_state->model.candidate_cost += (candidate_cost - search_state->model.candidate_cost) / 8.0;
+	}
+}
+
+typedef struct
+{
+	uint8_t *target;
+	const uint8_t *source;
+	size_t length;
+}
+place_slice_t;
 
-	//Threads enabled?
-	if ((!thread_pool) || (!thread_pool->thread_count) || (haystack_len <= 16384U))
+static void _place_slice(const uintptr_t data)
+{
+	const place_slice_t *const slice = (const place_slice_t*)data;
+	memcpy(slice->target, slice->source, slice->length);
+}
+
+static inline uint64_t place_boundary(const thread_pool_t *const thread_pool, const uint64_t haystack_len, const uint_fast32_t slice)
+{
+	//The haystack is placed in one slice per pinned worker (the calling thread is not pinned, so it places nothing)
+	const uint_fast32_t worker_count = thread_pool->thread_count - 1U;
+	return ((haystack_len / worker_count) * slice) + (((haystack_len % worker_count) * slice) / worker_count);
+}
+
+static inline uint8_t *place_haystack(thread_pool_t *const thread_pool, const uint8_t *const haystack, const uint64_t haystack_len)
+{
+	//Copy the haystack, each pinned worker copies (and thus first touches) the slice that it is going to search
+	const uint_fast32_t worker_count = thread_pool->thread_count - 1U;
+	uint8_t *const buffer = (haystack_len <= SIZE_MAX) ? (uint8_t*)malloc((size_t)haystack_len * sizeof(uint8_t)) : NULL;
+	if ((!buffer) || (worker_count < 1U))
 	{
-		thread_param[0U].search_param = &search_param;
-		thread_param[0U].search_range.begin = 0U;
-		thread_param[0U].search_range.end = haystack_len;
-		_find_optimal_substring((uintptr_t)&thread_param[0U]);
-		if (thread_param[0U].result.score)
+		return buffer ? (uint8_t*)memcpy(buffer, haystack, (size_t)haystack_len) : NULL;
+	}
+	place_slice_t *const slices = (place_slice_t*)calloc(worker_count, sizeof(place_slice_t));
+	pool_task_t *const task_queue = (pool_task_t*)calloc(worker_count, sizeof(pool_task_t));
+	if (slices && task_queue)
+	{
+		for (uint_fast32_t t = 0U; t < worker_count; ++t)
+		{
+			const size_t slice_begin = (size_t)place_boundary(thread_pool, haystack_len, t);
+			slices[t].target = buffer + slice_begin;
+			slices[t].source = haystack + slice_begin;
+			slices[t].length = (size_t)place_boundary(thread_pool, haystack_len, t + 1U) - slice_begin;
+			task_queue[t].func = _place_slice;
+			task_queue[t].data = (uintptr_t)&slices[t];
+		}
+		mpatch_pool_exec_affine(thread_pool, task_queue, worker_count);
+	}
+	free(slices);
+	free(task_queue);
+	if (!(slices && task_queue))
+	{
+		free(buffer);
+		return NULL;
+	}
+	return buffer;
+}
+
+static inline uint64_t _search_range(substring_t *const substring, const search_param_t *const search_param, thread_pool_t *const thread_pool, search_state_t *const search_state, const uint64_t search_begin, const uint64_t search_end)
+{
+	const uint8_t *const needle = search_param->needle, *const haystack = search_param->haystack;
+	const uint64_t needle_len = search_param->needle_len, haystack_len = search_param->haystack_len;
+
+	//Split the search, if that is expected to pay off
+	uint_fast32_t split = 1U;
+	if (thread_pool && (thread_pool->thread_count > 1U) && (needle_len > 0U))
+	{
+		if (search_state->model.haystack != haystack)
+		{
+			calibrate_search_model(search_state, haystack, haystack_len);
+		}
+		split = plan_search_split(search_state, thread_pool, needle[0U], search_end - search_begin);
+		if (thread_pool->pinned)
+		{
+			split = min_uint32(split, thread_pool->thread_count - 1U); /*one range per pinned worker at most*/
+		}
+		if ((split > 1U) && (!reserve_search_state(search_state, split)))
 		{
-			memcpy(substring, &thread_param[0U].result.data, sizeof(substring_t));
-			return thread_param[0U].result.score;
+			split = 1U;
+		}
+	}
+	search_state->split_hist[bit_length_uint32((uint32_t)(split >> 1U))]++;
+
+	//Search serially?
+	if (split < 2U)
+	{
+		search_thread_t thread_param;
+		memset(&thread_param, 0, sizeof(search_thread_t));
+		thread_param.search_param = search_param;
+		thread_param.search_range.begin = search_begin;
+		thread_param.search_range.end = search_end;
+		const uint64_t time_begin = thread_pool ? mpatch_pool_clock() : 0U;
+		_find_optimal_substring((uintptr_t)&thread_param);
+		if (thread_pool)
+		{
+			update_search_model(search_state, thread_pool, 1U, search_end - search_begin, thread_param.candidates, mpatch_pool_clock() - time_begin);
+		}
+		if (thread_param.result.score)
+		{
+			memcpy(substring, &thread_param.result.data, sizeof(substring_t));
+			return thread_param.result.score;
 		}
 		return 0U;
 	}
 
 	//Compute step size
-	const uint_fast32_t step_size = (haystack_len / thread_pool->thread_count) + 1U;
+	const uint64_t step_size = ((search_end - search_begin) / split) + 1U;
 
-	//Set up task parameters
-	pool_task_t task_queue[MAX_THREAD_COUNT];
-	uint_fast32_t range_offset = 0U;
-	for (uint_fast32_t t = 0U; t < thread_pool->thread_count; ++t)
+	//Set up task parameters (with pinned threads, range "t" is made of the placed slices that belong to the worker which
+	//exec_affine() assigns task "t" to, and to the workers up to the next task's, so each range is searched where it was
+	//placed; that may leave some ranges empty, if only a part of the haystack is searched)
+	search_thread_t *const thread_param = search_state->thread_param;
+	pool_task_t *const task_queue = search_state->task_queue;
+	uint64_t range_offset = search_begin;
+	for (uint_fast32_t t = 0U; t < split; ++t)
 	{
-		thread_param[t].search_param = &search_param;
+		const uint64_t range_end = thread_pool->pinned ? place_boundary(thread_pool, haystack_len, (uint_fast32_t)((((uint64_t)t + 1U) * (thread_pool->thread_count - 1U)) / split)) : (range_offset + step_size);
+		thread_param[t].search_param = search_param;
 		thread_param[t].search_range.begin = range_offset;
-		thread_param[t].search_range.end = min_uint32(haystack_len, range_offset + step_size);
+		thread_param[t].search_range.end = max_uint64(range_offset, min_uint64(search_end, range_end));
 		range_offset = thread_param[t].search_range.end;
 		task_queue[t].func = _find_optimal_substring;
 		task_queue[t].data = (uintptr_t)(&thread_param[t]);
 	}
 
-	//Execute tasks
-	mpatch_pool_exec(thread_pool, task_queue, thread_pool->thread_count);
+	//Execute tasks (with pinned threads, each range is searched by the worker that placed it)
+	const uint64_t time_begin = mpatch_pool_clock();
+	if (thread_pool->pinned)
+	{
+		mpatch_pool_exec_affine(thread_pool, task_queue, split);
+	}
+	else
+	{
+		mpatch_pool_exec(thread_pool, task_queue, split);
+	}
+	const uint64_t elapsed = mpatch_pool_clock() - time_begin;
 
 	//Find the "optimal" thread result
-	uint64_t best_score = 0U;
-	for (uint_fast32_t t = 0U; t < thread_pool->thread_count; ++t)
+	uint64_t candidates = 0U;
+	for (uint_fast32_t t = 0U; t < split; ++t)
+	{
+		candidates += thread_param[t].candidates;
+	}
+	update_search_model(search_state, thread_pool, split, search_end - search_begin, candidates, elapsed);
+	reduce_search_results(thread_param, split);
+	if (thread_param[0U].result.score)
+	{
+		memcpy(substring, &thread_param[0U].result.data, sizeof(substring_t));
+	}
+	return thread_param[0U].result.score;
+}
+
+static inline uint64_t find_optimal_substring(substring_t *const substring, const uint64_t prev_offset, thread_pool_t *const thread_pool, search_state_t *const search_state, const uint8_t *const needle, const uint64_t needle_len, const uint8_t *const haystack, const uint64_t haystack_begin, const uint64_t haystack_len)
+{
+	//Common search parameters
+	const search_param_t search_param = { prev_offset, needle, needle_len, haystack, haystack_len, search_state->cancel };
+
+	//Initialize result
+	memset(substring, 0, sizeof(substring_t));
+
+	//Nothing to search?
+	if (haystack_begin >= haystack_len)
+	{
+		return 0U;
+	}
+
+	//Restrict the search to a window around the previous offset, if requested
+	if (search_state->window && (search_state->window < haystack_len - haystack_begin))
+	{
+		const uint64_t window_begin = (prev_offset > (search_state->window / 2U)) ? (prev_offset - (search_state->window / 2U)) : 0U;
+		const uint64_t search_begin = min_uint64((window_begin > haystack_begin) ? window_begin : haystack_begin, haystack_len - search_state->window);
+		return _search_range(substring, &search_param, thread_pool, search_state, search_begin, search_begin + search_state->window);
+	}
+
+	//Restrict the search to the windows selected by the fingerprint index, if available (on a tie the lower range wins)
+	if (search_state->index)
 	{
-		if (thread_param[t].result.score > best_score)
+		const uint_fast32_t count = fp_select_ranges(search_state->index, search_state->ranges, needle, needle_len, prev_offset, haystack_begin, haystack_len);
+		uint64_t optimal_score = 0U;
+		for (uint_fast32_t r = 0U; r < count; ++r)
 		{
-			memcpy(substring, &thread_param[t].result.data, sizeof(substring_t));
-			best_score = thread_param[t].result.score;
+			substring_t range_substr;
+			const uint64_t score = _search_range(&range_substr, &search_param, thread_pool, search_state, search_state->ranges[r].begin, search_state->ranges[r].end);
+			if (score > optimal_score)
+			{
+				memcpy(substring, &range_substr, sizeof(substring_t));
+				optimal_score = score;
+			}
 		}
+		return optimal_score;
 	}
-	return best_score;
+
+	return _search_range(substring, &search_param, thread_pool, search_state, haystack_begin, haystack_len);
 }
 
 #endif /*_INC_MPATCH_SUBSTRING_H*/
@@ -23,14 +23,62 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <malloc.h>
+#endif
 
 #define BOOLIFY(X) (!!(X))
 
+/*per-thread state is aligned to cache lines, so that threads do not invalidate each other's cache lines*/
+#define CACHE_LINE 64U
+#ifdef _MSC_VER
+#define CACHE_ALIGN __declspec(align(64))
+#else
+#define CACHE_ALIGN __attribute__((aligned(64)))
+#endif
+
+/*long-running loops poll the cancellation token at least once per CANCEL_POLL_SIZE bytes of input*/
+#define CANCEL_POLL_SIZE 1048576U
+
+typedef volatile uint32_t cancel_token_t;
+
+static __forceinline bool is_cancelled(const cancel_token_t *const token)
+{
+#ifdef _MSC_VER
+	return token && (*token);
+#else
+	return token && __atomic_load_n(token, __ATOMIC_RELAXED);
+#endif
+}
+
+static __forceinline void set_cancelled(cancel_token_t *const token)
+{
+#ifdef _MSC_VER
+	_InterlockedExchange((volatile long*)token, 1L);
+#else
+	__atomic_store_n(token, 1U, __ATOMIC_RELAXED);
+#endif
+}
+
 static __forceinline uint_fast32_t min_uint32(const uint_fast32_t a, const uint_fast32_t b)
 {
 	return (a < b) ? a : b;
 }
 
+static __forceinline uint64_t min_uint64(const uint64_t a, const uint64_t b)
+{
+	return (a < b) ? a : b;
+}
+
+static __forceinline uint64_t max_uint64(const uint64_t a, const uint64_t b)
+{
+	return (a > b) ? a : b;
+}
+
 static __forceinline float min_flt(const float a, const float b)
 {
 	return (a < b) ? a : b;
@@ -41,6 +89,11 @@ static __forceinline uint_fast32_t diff_uint32(const uint_fast32_t a, const uint
 	return (a > b) ? (a - b) : (b - a);
 }
 
+static __forceinline uint64_t diff_uint64(const uint64_t a, const uint64_t b)
+{
+	return (a > b) ? (a - b) : (b - a);
+}
+
 static __forceinline uint_fast32_t mean_uint32(const uint_fast32_t a, const uint_fast32_t b)
 {
 	return (a / 2U) + (b / 2U) + (a & b & 1U);
@@ -56,6 +109,70 @@ static __forceinline uint_fast32_t inc_bound_uint32(uint_fast32_t *const val, co
 	return (*val < max) ? ++(*val) : max;
 }
 
+static __forceinline uint_fast32_t bit_length_uint32(const uint32_t val)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	return _BitScanReverse(&index, val) ? (uint_fast32_t)(index + 1U) : 0U;
+#else
+	return val ? (uint_fast32_t)(32 - __builtin_clz(val)) : 0U;
+#endif
+}
+
+static __forceinline uint_fast32_t bit_length_uint64(const uint64_t val)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long index;
+	return _BitScanReverse64(&index, val) ? (uint_fast32_t)(index + 1U) : 0U;
+#elif defined(_MSC_VER)
+	const uint32_t hi = (uint32_t)(val >> 32);
+	return hi ? (32U + bit_length_uint32(hi)) : bit_length_uint32((uint32_t)val);
+#else
+	return val ? (uint_fast32_t)(64 - __builtin_clzll(val)) : 0U;
+#endif
+}
+
+static __forceinline uint_fast32_t trailing_zeros_uint32(const uint32_t val)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	return _BitScanForward(&index, val) ? (uint_fast32_t)index : 32U;
+#else
+	return val ? (uint_fast32_t)__builtin_ctz(val) : 32U;
+#endif
+}
+
+static inline void *calloc_aligned(const size_t count, const size_t size)
+{
+	if ((count < 1U) || (size < 1U) || (count > (SIZE_MAX / size)))
+	{
+		return NULL;
+	}
+#ifdef _MSC_VER
+	void *const ptr = _aligned_malloc(count * size, CACHE_LINE);
+#else
+	void *ptr;
+	if (posix_memalign(&ptr, CACHE_LINE, count * size))
+	{
+		ptr = NULL;
+	}
+#endif
+	if (ptr)
+	{
+		memset(ptr, 0, count * size);
+	}
+	return ptr;
+}
+
+static inline void free_aligned(void *const ptr)
+{
+#ifdef _MSC_VER
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
 static inline void enc_uint32(uint8_t *const buffer, const uint32_t value)
 {
 	static const size_t SHIFT[4] = { 24U, 16U, 8U, 0U };
@@ -75,4 +192,18 @@ static inline void dec_uint32(uint32_t *const value, const uint8_t *const buffer
 	}
 }
 
+static inline void enc_uint64(uint8_t *const buffer, const uint64_t value)
+{
+	enc_uint32(buffer, (uint32_t)(value >> 32));
+	enc_uint32(buffer + 4U, (uint32_t)value);
+}
+
+static inline void dec_uint64(uint64_t *const value, const uint8_t *const buffer)
+{
+	uint32_t hi, lo;
+	dec_uint32(&hi, buffer);
+	dec_uint32(&lo, buffer + 4U);
+	*value = (((uint64_t)hi) << 32) | lo;
+}
+
 #endif /*_INC_MPATCH_UTILS_H*/